@@ -0,0 +1,389 @@
+/*
+ * Measure the per-operation cost of the core buffer and queue functions, and
+ * the throughput of cbuf_sys_read() and cbuf_sys_write() through a pipe and
+ * a socket pair.  Results are written to stdout as JSON.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include "libcbuf.h"
+
+#define	BENCH_BUFSZ		(64 * 1024)
+#define	BENCH_GETPUT_BYTES	(256ULL * 1024 * 1024)
+#define	BENCH_IO_BYTES		(512ULL * 1024 * 1024)
+
+#define	BENCH_FAIL(what)						\
+	do {								\
+		perror(what);						\
+		exit(1);						\
+	} while (0)
+
+/*
+ * Results are kept out of reach of the optimiser by adding them to this.
+ */
+static volatile uint64_t bench_sink;
+static bool bench_first = true;
+
+static uint64_t
+bench_now(void)
+{
+	struct timespec ts;
+
+	(void) clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec);
+}
+
+/*
+ * Print one result object.  "params" holds any extra JSON members, each
+ * followed by a comma.
+ */
+static void
+bench_report(const char *name, const char *params, uint64_t ops,
+    uint64_t nsec)
+{
+	printf("%s    { \"name\": \"%s\", %s\"ops\": %llu, \"nsec\": %llu, "
+	    "\"ns_per_op\": %.2f }", bench_first ? "" : ",\n", name, params,
+	    (unsigned long long)ops, (unsigned long long)nsec,
+	    (double)nsec / (double)ops);
+	bench_first = false;
+}
+
+static const char *
+bench_order_name(unsigned int order)
+{
+	return (order == CBUF_ORDER_BIG_ENDIAN ? "big" : "little");
+}
+
+#define	BENCH_GETPUT(type, bits)					\
+static void								\
+bench_getput_u##bits(unsigned int order)				\
+{									\
+	size_t per = BENCH_BUFSZ / sizeof (type);			\
+	uint64_t rounds = BENCH_GETPUT_BYTES / BENCH_BUFSZ;		\
+	uint64_t put_nsec = 0, get_nsec = 0, sum = 0;			\
+	char params[64];						\
+	cbuf_t *cbuf;							\
+									\
+	if (cbuf_alloc(&cbuf, BENCH_BUFSZ) != 0) {			\
+		BENCH_FAIL("cbuf_alloc");				\
+	}								\
+	cbuf_byteorder_set(cbuf, order);				\
+									\
+	for (uint64_t r = 0; r < rounds; r++) {				\
+		uint64_t start = bench_now();				\
+		for (size_t i = 0; i < per; i++) {			\
+			(void) cbuf_put_u##bits(cbuf, (type)i);		\
+		}							\
+		put_nsec += bench_now() - start;			\
+									\
+		cbuf_flip(cbuf);					\
+									\
+		start = bench_now();					\
+		for (size_t i = 0; i < per; i++) {			\
+			type val;					\
+			(void) cbuf_get_u##bits(cbuf, &val);		\
+			sum += val;					\
+		}							\
+		get_nsec += bench_now() - start;			\
+									\
+		cbuf_clear(cbuf);					\
+	}								\
+	bench_sink += sum;						\
+									\
+	(void) snprintf(params, sizeof (params),			\
+	    "\"order\": \"%s\", ", bench_order_name(order));		\
+	bench_report("cbuf_put_u" #bits, params, rounds * per, put_nsec); \
+	bench_report("cbuf_get_u" #bits, params, rounds * per, get_nsec); \
+									\
+	cbuf_free(cbuf);						\
+}
+
+BENCH_GETPUT(uint8_t, 8)
+BENCH_GETPUT(uint16_t, 16)
+BENCH_GETPUT(uint32_t, 32)
+BENCH_GETPUT(uint64_t, 64)
+
+/*
+ * Compact a buffer that has "remain" bytes left after the position.
+ */
+static void
+bench_compact(size_t remain)
+{
+	uint64_t ops = 1000000, nsec = 0;
+	size_t cap = 2 * remain;
+	char params[64];
+	cbuf_t *cbuf;
+
+	if (cbuf_alloc(&cbuf, cap) != 0) {
+		BENCH_FAIL("cbuf_alloc");
+	}
+
+	for (uint64_t i = 0; i < ops; i++) {
+		cbuf_clear(cbuf);
+		(void) cbuf_position_set(cbuf, cap - remain);
+
+		uint64_t start = bench_now();
+		cbuf_compact(cbuf);
+		nsec += bench_now() - start;
+	}
+
+	(void) snprintf(params, sizeof (params), "\"bytes\": %zu, ", remain);
+	bench_report("cbuf_compact", params, ops, nsec);
+
+	cbuf_free(cbuf);
+}
+
+static void
+bench_copy(size_t size)
+{
+	uint64_t ops = BENCH_GETPUT_BYTES / size, nsec = 0;
+	char params[64];
+	cbuf_t *src, *dst;
+
+	if (cbuf_alloc(&src, size) != 0 || cbuf_alloc(&dst, size) != 0) {
+		BENCH_FAIL("cbuf_alloc");
+	}
+	(void) cbuf_position_set(src, size);
+	cbuf_flip(src);
+
+	uint64_t start = bench_now();
+	for (uint64_t i = 0; i < ops; i++) {
+		cbuf_rewind(src);
+		cbuf_clear(dst);
+		bench_sink += cbuf_copy(src, dst);
+	}
+	nsec = bench_now() - start;
+
+	(void) snprintf(params, sizeof (params), "\"bytes\": %zu, ", size);
+	bench_report("cbuf_copy", params, ops, nsec);
+
+	cbuf_free(src);
+	cbuf_free(dst);
+}
+
+/*
+ * Pull up an entire queue of "nsegs" buffers, each holding "segsz" bytes.
+ */
+static void
+bench_pullup(unsigned int nsegs, size_t segsz)
+{
+	uint64_t ops = 1000000 / nsegs, nsec = 0;
+	size_t total = (size_t)nsegs * segsz;
+	char params[64];
+	cbufq_t *cbufq;
+
+	for (uint64_t i = 0; i < ops; i++) {
+		if (cbufq_alloc(&cbufq) != 0) {
+			BENCH_FAIL("cbufq_alloc");
+		}
+		for (unsigned int s = 0; s < nsegs; s++) {
+			cbuf_t *cbuf;
+
+			if (cbuf_alloc(&cbuf, segsz) != 0) {
+				BENCH_FAIL("cbuf_alloc");
+			}
+			(void) cbuf_position_set(cbuf, segsz);
+			cbuf_flip(cbuf);
+			cbufq_enq(cbufq, cbuf);
+		}
+
+		uint64_t start = bench_now();
+		if (cbufq_pullup(cbufq, total) != 0) {
+			BENCH_FAIL("cbufq_pullup");
+		}
+		nsec += bench_now() - start;
+
+		cbufq_free(cbufq);
+	}
+
+	(void) snprintf(params, sizeof (params),
+	    "\"segments\": %u, \"segment_bytes\": %zu, ", nsegs, segsz);
+	bench_report("cbufq_pullup", params, ops, nsec);
+}
+
+static void
+bench_available(unsigned int depth)
+{
+	uint64_t ops = 10000000, nsec;
+	char params[64];
+	cbufq_t *cbufq;
+
+	if (cbufq_alloc(&cbufq) != 0) {
+		BENCH_FAIL("cbufq_alloc");
+	}
+	for (unsigned int i = 0; i < depth; i++) {
+		cbuf_t *cbuf;
+
+		if (cbuf_alloc(&cbuf, 64) != 0) {
+			BENCH_FAIL("cbuf_alloc");
+		}
+		(void) cbuf_put_u64(cbuf, i);
+		cbuf_flip(cbuf);
+		cbufq_enq(cbufq, cbuf);
+	}
+
+	uint64_t start = bench_now();
+	for (uint64_t i = 0; i < ops; i++) {
+		bench_sink += cbufq_available(cbufq);
+	}
+	nsec = bench_now() - start;
+
+	(void) snprintf(params, sizeof (params), "\"depth\": %u, ", depth);
+	bench_report("cbufq_available", params, ops, nsec);
+
+	cbufq_free(cbufq);
+}
+
+typedef struct bench_writer {
+	int bw_fd;
+	size_t bw_chunk;
+} bench_writer_t;
+
+static void *
+bench_writer(void *arg)
+{
+	bench_writer_t *bw = arg;
+	uint64_t left = BENCH_IO_BYTES;
+	cbuf_t *cbuf;
+
+	if (cbuf_alloc(&cbuf, bw->bw_chunk) != 0) {
+		BENCH_FAIL("cbuf_alloc");
+	}
+
+	while (left > 0) {
+		size_t want = (left < bw->bw_chunk) ? left : bw->bw_chunk;
+		size_t actual;
+
+		cbuf_clear(cbuf);
+		(void) cbuf_limit_set(cbuf, want);
+		while (cbuf_available(cbuf) > 0) {
+			if (cbuf_sys_write(cbuf, bw->bw_fd, CBUF_SYSREAD_ENTIRE,
+			    &actual) != 0) {
+				BENCH_FAIL("cbuf_sys_write");
+			}
+		}
+		left -= want;
+	}
+
+	cbuf_free(cbuf);
+	(void) close(bw->bw_fd);
+	return (NULL);
+}
+
+/*
+ * Move BENCH_IO_BYTES from a writer thread to this one, in "chunk" byte
+ * reads and writes.
+ */
+static void
+bench_io(const char *kind, size_t chunk)
+{
+	bench_writer_t bw = { .bw_chunk = chunk };
+	uint64_t got = 0, reads = 0, nsec;
+	pthread_t thread;
+	char params[128];
+	cbuf_t *cbuf;
+	int fds[2];
+
+	if (strcmp(kind, "pipe") == 0) {
+		if (pipe(fds) != 0) {
+			BENCH_FAIL("pipe");
+		}
+	} else if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+		BENCH_FAIL("socketpair");
+	}
+	bw.bw_fd = fds[1];
+
+	if (cbuf_alloc(&cbuf, chunk) != 0) {
+		BENCH_FAIL("cbuf_alloc");
+	}
+
+	uint64_t start = bench_now();
+	if (pthread_create(&thread, NULL, bench_writer, &bw) != 0) {
+		BENCH_FAIL("pthread_create");
+	}
+
+	for (;;) {
+		size_t actual;
+
+		cbuf_clear(cbuf);
+		if (cbuf_sys_read(cbuf, fds[0], CBUF_SYSREAD_ENTIRE,
+		    &actual) != 0) {
+			BENCH_FAIL("cbuf_sys_read");
+		}
+		if (actual == 0) {
+			break;
+		}
+		got += actual;
+		reads++;
+	}
+	nsec = bench_now() - start;
+
+	(void) pthread_join(thread, NULL);
+	(void) close(fds[0]);
+	cbuf_free(cbuf);
+
+	if (got != BENCH_IO_BYTES) {
+		fprintf(stderr, "bench_io: short transfer\n");
+		exit(1);
+	}
+
+	(void) snprintf(params, sizeof (params),
+	    "\"transport\": \"%s\", \"chunk_bytes\": %zu, \"bytes\": %llu, "
+	    "\"mb_per_sec\": %.1f, ", kind, chunk, (unsigned long long)got,
+	    (double)got / 1048576.0 / ((double)nsec / 1e9));
+	bench_report("cbuf_sys_read_write", params, reads, nsec);
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned int orders[] = {
+		CBUF_ORDER_BIG_ENDIAN, CBUF_ORDER_LITTLE_ENDIAN
+	};
+	size_t sizes[] = { 64, 1024, 16384 };
+	unsigned int segs[] = { 2, 8, 32, 128 };
+	unsigned int depths[] = { 1, 16, 256, 4096 };
+	size_t chunks[] = { 4096, 65536 };
+
+	printf("{\n  \"benchmark\": \"cbuf\",\n  \"results\": [\n");
+
+	for (unsigned int o = 0; o < 2; o++) {
+		bench_getput_u8(orders[o]);
+		bench_getput_u16(orders[o]);
+		bench_getput_u32(orders[o]);
+		bench_getput_u64(orders[o]);
+	}
+
+	for (unsigned int i = 0; i < 3; i++) {
+		bench_compact(sizes[i]);
+	}
+	for (unsigned int i = 0; i < 3; i++) {
+		bench_copy(sizes[i]);
+	}
+
+	for (unsigned int i = 0; i < 4; i++) {
+		bench_pullup(segs[i], 64);
+		bench_pullup(segs[i], 1024);
+	}
+
+	for (unsigned int i = 0; i < 4; i++) {
+		bench_available(depths[i]);
+	}
+
+	for (unsigned int i = 0; i < 2; i++) {
+		bench_io("pipe", chunks[i]);
+		bench_io("socketpair", chunks[i]);
+	}
+
+	printf("\n  ]\n}\n");
+
+	return (0);
+}
@@ -0,0 +1,143 @@
+/*
+ * Measure the throughput of a cbufq_mpsc_t with 1, 4, 16 and 64 producer
+ * threads feeding one consumer, which splices batches into a cbufq_t.
+ * Results are written to stdout as JSON.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "libcbuf.h"
+
+#define	MPSC_BENCH_TOTAL	(1U << 21)
+
+typedef struct mpsc_bench_producer {
+	pthread_t mbp_thread;
+	cbufq_mpsc_t *mbp_mpsc;
+	pthread_barrier_t *mbp_barrier;
+	cbuf_t **mbp_bufs;
+	size_t mbp_count;
+} mpsc_bench_producer_t;
+
+static uint64_t
+mpsc_bench_now(void)
+{
+	struct timespec ts;
+
+	(void) clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec);
+}
+
+static void *
+mpsc_bench_producer(void *arg)
+{
+	mpsc_bench_producer_t *mbp = arg;
+
+	(void) pthread_barrier_wait(mbp->mbp_barrier);
+
+	for (size_t i = 0; i < mbp->mbp_count; i++) {
+		cbufq_mpsc_enq(mbp->mbp_mpsc, mbp->mbp_bufs[i]);
+	}
+
+	return (NULL);
+}
+
+static int
+mpsc_bench_run(unsigned int nprod, uint64_t *nsecp, size_t *splicesp)
+{
+	size_t per = MPSC_BENCH_TOTAL / nprod;
+	size_t total = per * nprod;
+	mpsc_bench_producer_t *mbp;
+	pthread_barrier_t barrier;
+	cbufq_mpsc_t *mpsc;
+	cbufq_t *cbufq;
+	cbuf_t **bufs;
+
+	if (cbufq_mpsc_alloc(&mpsc) != 0 || cbufq_alloc(&cbufq) != 0 ||
+	    (mbp = calloc(nprod, sizeof (*mbp))) == NULL ||
+	    (bufs = calloc(total, sizeof (*bufs))) == NULL) {
+		return (-1);
+	}
+
+	/*
+	 * Allocate every buffer up front so that only the queue is measured.
+	 */
+	for (size_t i = 0; i < total; i++) {
+		if (cbuf_alloc(&bufs[i], 16) != 0) {
+			return (-1);
+		}
+		(void) cbuf_put_u64(bufs[i], i);
+		cbuf_flip(bufs[i]);
+	}
+
+	(void) pthread_barrier_init(&barrier, NULL, nprod + 1);
+	for (unsigned int p = 0; p < nprod; p++) {
+		mbp[p].mbp_mpsc = mpsc;
+		mbp[p].mbp_barrier = &barrier;
+		mbp[p].mbp_bufs = &bufs[p * per];
+		mbp[p].mbp_count = per;
+		if (pthread_create(&mbp[p].mbp_thread, NULL,
+		    mpsc_bench_producer, &mbp[p]) != 0) {
+			return (-1);
+		}
+	}
+
+	(void) pthread_barrier_wait(&barrier);
+	uint64_t start = mpsc_bench_now();
+
+	size_t received = 0, splices = 0;
+	while (received < total) {
+		size_t n;
+
+		if ((n = cbufq_mpsc_splice(mpsc, cbufq)) > 0) {
+			received += n;
+			splices++;
+		}
+	}
+
+	*nsecp = mpsc_bench_now() - start;
+	*splicesp = splices;
+
+	for (unsigned int p = 0; p < nprod; p++) {
+		(void) pthread_join(mbp[p].mbp_thread, NULL);
+	}
+	(void) pthread_barrier_destroy(&barrier);
+
+	cbufq_free(cbufq);
+	cbufq_mpsc_free(mpsc);
+	free(bufs);
+	free(mbp);
+	return (0);
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned int producers[] = { 1, 4, 16, 64 };
+	unsigned int nproducers = sizeof (producers) / sizeof (producers[0]);
+
+	printf("{\n  \"benchmark\": \"cbufq_mpsc\",\n  \"results\": [\n");
+	for (unsigned int i = 0; i < nproducers; i++) {
+		size_t ops = MPSC_BENCH_TOTAL / producers[i] * producers[i];
+		size_t splices;
+		uint64_t nsec;
+
+		if (mpsc_bench_run(producers[i], &nsec, &splices) != 0) {
+			perror("mpsc_bench_run");
+			return (1);
+		}
+
+		printf("    { \"producers\": %u, \"ops\": %zu, \"nsec\": %llu, "
+		    "\"ns_per_op\": %.2f, \"splices\": %zu }%s\n",
+		    producers[i], ops, (unsigned long long)nsec,
+		    (double)nsec / (double)ops, splices,
+		    (i + 1 < nproducers) ? "," : "");
+	}
+	printf("  ]\n}\n");
+
+	return (0);
+}
@@ -14,17 +14,113 @@
 
 typedef struct cbuf cbuf_t;
 typedef struct cbufq cbufq_t;
+typedef struct cbuf_pool cbuf_pool_t;
+typedef struct cbufq_spsc cbufq_spsc_t;
+typedef struct cbufq_mpsc cbufq_mpsc_t;
+typedef struct cbuf_splice cbuf_splice_t;
+typedef struct cbuf_uring cbuf_uring_t;
+typedef struct cbuf_zc cbuf_zc_t;
 
 /*
  * Create and free buffers.  At creation, the position is 0 and the limit is
  * the capacity, as if cbuf_clear() had been called.
+ *
+ * A buffer with a capacity of at most the inline size (by default,
+ * CBUF_INLINE_MAX_DEFAULT bytes) keeps its data immediately after the
+ * buffer header, in the same allocation.  If it is extended beyond its
+ * capacity, the data moves to a separate allocation.  An inline size of 0
+ * gives every buffer a separate allocation.
  */
+#define	CBUF_INLINE_MAX_DEFAULT		128
+
 extern int cbuf_alloc(cbuf_t **cbufp, size_t capacity);
 extern void cbuf_free(cbuf_t *cbuf);
 
+extern void cbuf_inline_max_set(size_t inline_max);
+
+/*
+ * Buffer pools.  A pool is created with a list of size classes, in ascending
+ * order.  Buffers allocated from a pool have their header and backing store
+ * in a single allocation, and are kept on a per-class free list when passed
+ * to cbuf_free() so that they may be reused without calling malloc(3C).  A
+ * request larger than the largest size class is satisfied by cbuf_alloc().
+ * Pools are not safe for concurrent use by multiple threads.  All buffers
+ * must be freed before the pool is destroyed.
+ */
+extern int cbuf_pool_create(cbuf_pool_t **poolp, const size_t *sizes,
+    unsigned int nsizes);
+extern void cbuf_pool_destroy(cbuf_pool_t *pool);
+extern int cbuf_pool_alloc(cbuf_pool_t *pool, cbuf_t **cbufp,
+    size_t capacity);
+
+/*
+ * Ring buffers.  The backing store is mapped twice, back to back, so that
+ * the "capacity" bytes starting at any offset in the ring are contiguous in
+ * memory.  The position and limit act as the head and tail of the ring:
+ * cbuf_compact() moves the start of the buffer up to the position without
+ * copying any data, making the consumed space available again at the end.
+ * The capacity is rounded up to a multiple of the page size.  Ring buffers
+ * cannot be extended or shrunk.
+ */
+extern int cbuf_ring_alloc(cbuf_t **cbufp, size_t capacity);
+
+/*
+ * Shared buffers.  cbuf_slice() and cbuf_dup() create new buffers which refer
+ * to the backing store of an existing buffer instead of copying it, like the
+ * data blocks of STREAMS messages.  A slice covers the "len" bytes starting
+ * at index "offset", which must end at or before the limit; its position is
+ * 0 and its limit is "len".  A duplicate covers the whole backing store, with
+ * the same position and limit as the original.  The backing store is freed
+ * along with the last buffer that refers to it; these buffers may be freed
+ * by different threads.
+ *
+ * Bytes written through one buffer are visible through the others.
+ * cbuf_compact() on a shared buffer moves its start up to the position
+ * instead of moving the data, and cbuf_extend() gives the buffer a private
+ * copy.  A shared ring buffer no longer wraps around.  Embedded storage, as
+ * used by pool buffers, is copied to the heap when it is first shared.
+ */
+extern int cbuf_slice(cbuf_t *cbuf, cbuf_t **slicep, size_t offset,
+    size_t len);
+extern int cbuf_dup(cbuf_t *cbuf, cbuf_t **dupp);
+
 extern int cbuf_extend(cbuf_t *cbuf, size_t new_capacity);
 extern int cbuf_shrink(cbuf_t *cbuf);
 
+/*
+ * Growth policies.  By default, cbuf_extend() makes the capacity exactly
+ * "new_capacity".  A buffer which grows a little at a time would then be
+ * reallocated on every call, so a buffer may instead be given a policy under
+ * which the capacity is grown to at least the requested size:
+ *
+ *	CBUF_GROWTH_GEOMETRIC	the capacity is doubled, but grown by at most
+ *				"max_step" bytes at a time (0 for no limit)
+ *	CBUF_GROWTH_POW2	the capacity is rounded up to a power of two
+ *
+ * cbufq_growth_set() sets the policy used when cbufq_pullup() has to extend
+ * the head buffer of a queue.
+ */
+typedef enum cbuf_growth {
+	CBUF_GROWTH_EXACT = 1,
+	CBUF_GROWTH_GEOMETRIC,
+	CBUF_GROWTH_POW2
+} cbuf_growth_t;
+
+extern void cbuf_growth_set(cbuf_t *cbuf, unsigned int policy,
+    size_t max_step);
+
+/*
+ * Large buffers.  The backing store of a buffer allocated or extended to at
+ * least the threshold size is mapped directly with mmap(2), and the kernel
+ * is asked to back it with huge pages (MADV_HUGEPAGE).  Such a buffer is
+ * extended with mremap(2), which moves the pages rather than copying the
+ * data.  The threshold defaults to CBUF_MMAP_THRESHOLD_DEFAULT bytes; a
+ * threshold of 0 disables the use of mmap(2) for new allocations.
+ */
+#define	CBUF_MMAP_THRESHOLD_DEFAULT	(2 * 1024 * 1024)
+
+extern void cbuf_mmap_threshold_set(size_t threshold);
+
 /*
  * The number of bytes in the backing store for this buffer.
  */
@@ -109,6 +205,18 @@ extern int cbuf_put_u16(cbuf_t *cbuf, uint16_t val);
 extern int cbuf_put_u32(cbuf_t *cbuf, uint32_t val);
 extern int cbuf_put_u64(cbuf_t *cbuf, uint64_t val);
 
+/*
+ * Get or put an array of "count" values.  The bounds are checked once for the
+ * whole array: if there is not enough room, nothing is transferred.
+ */
+extern int cbuf_get_u16v(cbuf_t *cbuf, uint16_t *vals, size_t count);
+extern int cbuf_get_u32v(cbuf_t *cbuf, uint32_t *vals, size_t count);
+extern int cbuf_get_u64v(cbuf_t *cbuf, uint64_t *vals, size_t count);
+
+extern int cbuf_put_u16v(cbuf_t *cbuf, const uint16_t *vals, size_t count);
+extern int cbuf_put_u32v(cbuf_t *cbuf, const uint32_t *vals, size_t count);
+extern int cbuf_put_u64v(cbuf_t *cbuf, const uint64_t *vals, size_t count);
+
 extern int cbuf_get_i8(cbuf_t *cbuf, int8_t *val);
 extern int cbuf_get_i16(cbuf_t *cbuf, int16_t *val);
 extern int cbuf_get_i32(cbuf_t *cbuf, int32_t *val);
@@ -137,11 +245,91 @@ extern int cbuf_sys_sendto(cbuf_t *cbuf, int fd, size_t want, size_t *actual,
 extern int cbuf_sys_send(cbuf_t *cbuf, int fd, size_t want, size_t *actual,
     int flags);
 
+/*
+ * Datagrams in batches.  cbuf_sys_recvmmsg() receives one datagram into each
+ * of up to "ncbufs" buffers (and at most CBUF_MMSG_MAX) with a single
+ * recvmmsg(2) call, and reports how many were received.  Each datagram is
+ * placed at the position of its buffer, which is then flipped, ready for
+ * gets.  If "dgrams" is not NULL, the entry for each buffer receives the
+ * source address, the message flags (e.g., MSG_TRUNC) and, for a socket with
+ * the UDP_GRO option set, the size of the segments that the kernel coalesced
+ * into the buffer (or 0).
+ *
+ * cbufq_sys_sendmmsg() sends each buffer in the queue, up to CBUF_MMSG_MAX of
+ * them, as one datagram with a single sendmmsg(2) call.  Buffers that were
+ * sent are removed from the queue and freed.  If "dgrams" is not NULL, entry
+ * "i" applies to the "i"th buffer: a non-zero address length gives the
+ * destination, and a non-zero segment size asks for the buffer to be split
+ * into datagrams of that size with UDP_SEGMENT.
+ */
+#define	CBUF_MMSG_MAX			256
+
+typedef struct cbuf_dgram {
+	struct sockaddr_storage cbdg_addr;
+	socklen_t cbdg_addrlen;
+	int cbdg_flags;
+	size_t cbdg_segsize;		/* UDP GRO/GSO segment size, or 0 */
+} cbuf_dgram_t;
+
+extern int cbuf_sys_recvmmsg(cbuf_t **cbufs, unsigned int ncbufs, int fd,
+    int flags, cbuf_dgram_t *dgrams, unsigned int *actual);
+extern int cbufq_sys_sendmmsg(cbufq_t *cbufq, int fd, int flags,
+    const cbuf_dgram_t *dgrams, unsigned int *actual);
+
 extern size_t cbuf_copy(cbuf_t *, cbuf_t *);
 
+/*
+ * CHECKSUMS
+ *
+ * cbuf_crc32c() computes the CRC-32C (Castagnoli) of the "len" bytes of a
+ * buffer starting at index "offset", which must end at or before the limit.
+ * cbufq_crc32c() does the same for the first "len" bytes available in a
+ * queue, reading across buffers without pulling them up; if the queue holds
+ * fewer bytes, it fails with ENODATA.  "*crcp" holds the CRC of any data
+ * that came before, or 0, and is updated, so that a CRC may be computed
+ * piecewise.  The CRC32 instruction is used where the CPU has one.
+ *
+ * cbuf_inet_csum() and cbufq_inet_csum() compute the Internet checksum (RFC
+ * 1071) over the same ranges: the one's complement of the one's complement
+ * sum of the data as big-endian 16-bit words.  The result may be stored in a
+ * header with cbuf_put_u16() in big-endian byte order.
+ *
+ * A checksum may also be computed while data is put into a buffer.
+ * cbuf_csum_start() begins a running checksum of the kind given, over the
+ * bytes from the current position onwards.  cbuf_csum_value() reports the
+ * checksum of the bytes up to the current position; it only reads the bytes
+ * put since the last call, while they are likely to be in the cache, and may
+ * be called as often as is convenient.  The position must not be moved back
+ * before the point last checksummed, or cbuf_csum_value() fails with EINVAL.
+ */
+typedef enum cbuf_csum {
+	CBUF_CSUM_NONE = 0,
+	CBUF_CSUM_CRC32C,
+	CBUF_CSUM_INET
+} cbuf_csum_t;
+
+extern int cbuf_crc32c(cbuf_t *cbuf, size_t offset, size_t len,
+    uint32_t *crcp);
+extern int cbufq_crc32c(cbufq_t *cbufq, size_t len, uint32_t *crcp);
+extern int cbuf_inet_csum(cbuf_t *cbuf, size_t offset, size_t len,
+    uint16_t *csump);
+extern int cbufq_inet_csum(cbufq_t *cbufq, size_t len, uint16_t *csump);
+
+extern void cbuf_csum_start(cbuf_t *cbuf, unsigned int kind);
+extern int cbuf_csum_value(cbuf_t *cbuf, uint32_t *valp);
+
 extern void cbuf_dump(cbuf_t *cbuf, FILE *fp);
 extern void cbufq_dump(cbufq_t *cbufq, FILE *fp);
 
+/*
+ * Ensure that at least "min_contig" bytes are available in the head buffer
+ * of the queue.  If the queue does not hold that many bytes, fails with
+ * ENODATA and leaves the queue unchanged.  At most one allocation is made:
+ * bytes are copied into the head buffer, or into a later buffer with enough
+ * capacity, and the head buffer is only extended if neither is possible.  It
+ * is extended to exactly "min_contig" bytes unless another policy has been
+ * set with cbufq_growth_set().
+ */
 extern int cbufq_pullup(cbufq_t *cbufq, size_t min_contig);
 
 /*
@@ -159,4 +347,415 @@ extern cbuf_t *cbufq_peek_tail(cbufq_t *);
 extern size_t cbufq_available(cbufq_t *);
 extern size_t cbufq_count(cbufq_t *);
 
+/*
+ * By default, cbufq_peek(), cbufq_deq() and cbufq_peek_tail() compact the
+ * buffer they return so that its data starts at index 0.  In the lazy mode,
+ * cbufq_deq() never compacts, and the peek functions only compact once the
+ * consumed prefix of the buffer exceeds half of its capacity; consumers must
+ * then use the buffer position rather than assuming it is 0.  The number of
+ * bytes moved by compaction is available from cbufq_compact_bytes().
+ */
+typedef enum cbufq_compact {
+	CBUFQ_COMPACT_ALWAYS = 1,
+	CBUFQ_COMPACT_LAZY
+} cbufq_compact_t;
+
+extern void cbufq_compact_set(cbufq_t *, unsigned int mode);
+extern size_t cbufq_compact_bytes(cbufq_t *);
+
+extern void cbufq_growth_set(cbufq_t *, unsigned int policy,
+    size_t max_step);
+
+/*
+ * Write as much of the queue as possible with a single writev(2) or
+ * sendmsg(2) call, gathering from the position to the limit of each buffer
+ * (up to IOV_MAX buffers).  Buffers that are completely written are removed
+ * from the queue and freed; a partially written buffer remains at the head
+ * of the queue with its position advanced past the written bytes.
+ */
+extern int cbufq_sys_writev(cbufq_t *cbufq, int fd, size_t *actual);
+extern int cbufq_sys_sendmsg(cbufq_t *cbufq, int fd, size_t *actual,
+    int flags);
+
+/*
+ * A cursor reads through the bytes in a queue, starting at the position of
+ * the head buffer, without consuming them or copying them between buffers.
+ * Multi-byte values may straddle buffers, and are decoded in the byte order
+ * of the buffer in which they start.  When not enough bytes remain, the get,
+ * peek and skip functions fail with ENOSPC and leave the cursor unchanged.
+ *
+ * A parser may mark a point to roll back to if a message turns out to be
+ * incomplete.  Once a whole message has been decoded, cbufq_cursor_commit()
+ * consumes the bytes before the cursor from the queue.
+ *
+ * A cursor remains valid while buffers are appended to the queue, or data is
+ * appended to the tail buffer (even if, as in cbufq_sys_readv() and
+ * cbufq_append(), that compacts a partly consumed head buffer).  Any other
+ * change to the queue (including cbufq_peek() and cbufq_deq(), which may
+ * compact the head buffer) requires the cursor to be initialised again.
+ */
+typedef struct cbufq_cursor {
+	cbufq_t *cbc_cbufq;
+	cbuf_t *cbc_cbuf;		/* buffer holding the next byte */
+	size_t cbc_offset;		/* next byte, from cbc_cbuf position */
+	size_t cbc_consumed;		/* bytes read since the queue head */
+
+	cbuf_t *cbc_mark_cbuf;
+	size_t cbc_mark_offset;
+	size_t cbc_mark_consumed;
+} cbufq_cursor_t;
+
+extern void cbufq_cursor_init(cbufq_cursor_t *cbc, cbufq_t *cbufq);
+extern size_t cbufq_cursor_available(cbufq_cursor_t *cbc);
+extern size_t cbufq_cursor_consumed(cbufq_cursor_t *cbc);
+
+extern int cbufq_cursor_get_u8(cbufq_cursor_t *cbc, uint8_t *val);
+extern int cbufq_cursor_get_u16(cbufq_cursor_t *cbc, uint16_t *val);
+extern int cbufq_cursor_get_u32(cbufq_cursor_t *cbc, uint32_t *val);
+extern int cbufq_cursor_get_u64(cbufq_cursor_t *cbc, uint64_t *val);
+extern int cbufq_cursor_get_bytes(cbufq_cursor_t *cbc, void *buf, size_t len);
+extern int cbufq_cursor_peek(cbufq_cursor_t *cbc, void *buf, size_t len);
+extern int cbufq_cursor_skip(cbufq_cursor_t *cbc, size_t skip_bytes);
+
+extern void cbufq_cursor_mark(cbufq_cursor_t *cbc);
+extern void cbufq_cursor_rollback(cbufq_cursor_t *cbc);
+extern void cbufq_cursor_commit(cbufq_cursor_t *cbc);
+
+/*
+ * Search the bytes available in a queue for a byte value, or for a sequence
+ * of "len" bytes, which may straddle buffers.  Offsets are counted from the
+ * position of the head buffer.  The search starts at "*offsetp", and on
+ * success "*offsetp" is set to the offset of the first match.  If there is
+ * no match, the functions fail with ENOENT and set "*offsetp" to the point
+ * at which the next search should start: the end of the data for a byte,
+ * or the earliest place a sequence could still begin once more data has
+ * been appended.  A parser waiting for a delimiter can therefore start at 0
+ * and search again each time data arrives, without examining any byte more
+ * than once (or, for a sequence, more than "len" times).  The offset must
+ * be reset whenever bytes are consumed from the queue.
+ */
+extern int cbufq_find_byte(cbufq_t *cbufq, uint8_t c, size_t *offsetp);
+extern int cbufq_find(cbufq_t *cbufq, const void *needle, size_t len,
+    size_t *offsetp);
+
+/*
+ * Set the allocator used when the queue needs to create buffers of its own.
+ * New buffers have a capacity of "bufsize" bytes, and are allocated from
+ * "pool" if it is not NULL.
+ */
+extern int cbufq_allocator_set(cbufq_t *cbufq, cbuf_pool_t *pool,
+    size_t bufsize);
+
+/*
+ * Append data to the queue by copying it into the unused space at the end of
+ * the tail buffer (as if after cbuf_resume()), rather than linking another
+ * buffer.  cbufq_append() copies "len" bytes, and allocates a new tail buffer
+ * (as by the queue allocator, or larger if need be) only for bytes that do
+ * not fit.  cbufq_enq_coalesce() takes a buffer, as cbufq_enq() does; if it
+ * holds no more than the coalescing threshold, and its bytes fit in the tail
+ * buffer, which has the same byte order, they are copied and the buffer is
+ * freed.  Otherwise, the buffer is enqueued as it is.  The threshold is
+ * CBUFQ_COALESCE_DEFAULT bytes unless set by cbufq_coalesce_set(); 0 turns
+ * coalescing off.  Shared tail buffers are never written to.
+ */
+#define	CBUFQ_COALESCE_DEFAULT		512
+
+extern int cbufq_append(cbufq_t *cbufq, const void *data, size_t len);
+extern void cbufq_enq_coalesce(cbufq_t *cbufq, cbuf_t *cbuf);
+extern void cbufq_coalesce_set(cbufq_t *cbufq, size_t threshold);
+
+/*
+ * Use a single readv(2) call to read up to "max" bytes, first into the unused
+ * space at the end of the tail buffer and then into as many newly allocated
+ * buffers as are needed.  Data read into the tail buffer extends its limit;
+ * new buffers that received data are appended to the queue, ready for gets.
+ */
+extern int cbufq_sys_readv(cbufq_t *cbufq, int fd, size_t max,
+    size_t *actual);
+
+/*
+ * Move the first "n" bytes of the queue onto the end of "dst".  Whole buffers
+ * are moved; if the last byte falls within a buffer, a slice of that buffer
+ * (see cbuf_slice()) is moved instead and the rest of the buffer stays at the
+ * head of the queue.  A buffer with embedded storage (a small buffer, or one
+ * from a pool) is not sliced; the bytes that move are copied into a new
+ * buffer instead.  Moved buffers that were partly consumed are compacted.
+ * If the queue holds fewer than "n" bytes, fails with ENODATA and leaves both
+ * queues unchanged.
+ */
+extern int cbufq_split(cbufq_t *cbufq, cbufq_t *dst, size_t n);
+
+/*
+ * Remove the next length-prefixed frame from the queue.  The frame starts
+ * with a length of "width" (1, 2 or 4) bytes in the byte order "order",
+ * which gives the number of bytes in the frame after the prefix.  The prefix
+ * is consumed, and the rest of the frame is returned as a new buffer, ready
+ * for gets in the same byte order.  If the frame lies within the first buffer
+ * that holds data, and that buffer's storage is not embedded in it (as it is
+ * for small buffers and those from a pool), the new buffer is a slice of it
+ * (see cbuf_slice()) and no data is copied.  Otherwise, the frame is copied
+ * into a buffer of exactly its size, allocated as by the queue allocator (see
+ * cbufq_allocator_set()).
+ *
+ * If the queue does not yet hold a complete frame, fails with ENODATA.  If
+ * the length is greater than "max_len", fails with EMSGSIZE before anything
+ * is allocated.  In either case the queue is left unchanged.
+ */
+extern int cbufq_frame_next(cbufq_t *cbufq, unsigned int width,
+    unsigned int order, size_t max_len, cbuf_t **framep);
+
+/*
+ * SINGLE-PRODUCER, SINGLE-CONSUMER QUEUES
+ *
+ * A bounded, lock-free queue for handing buffers from one thread to another.
+ * One thread may enqueue and one (other) thread may dequeue at the same time
+ * without any locking.  The capacity (in buffers) is rounded up to a power of
+ * two.  As with cbufq_enq(), buffers must be at position 0 when enqueued.
+ * The enqueue functions fail with ENOSPC (or enqueue fewer buffers than
+ * requested) when the queue is full.  cbufq_spsc_available() and
+ * cbufq_spsc_count() may be called from any thread.
+ *
+ * If created with CBUFQ_SPSC_EVENTFD, the queue has an eventfd(5) which
+ * becomes readable when buffers are enqueued into an empty queue.  The
+ * consumer should call cbufq_spsc_fd_clear() and then dequeue until the queue
+ * is empty before waiting on the descriptor again.
+ */
+#define	CBUFQ_SPSC_EVENTFD	0x1
+
+extern int cbufq_spsc_alloc(cbufq_spsc_t **spscp, size_t capacity,
+    int flags);
+extern void cbufq_spsc_free(cbufq_spsc_t *spsc);
+
+extern int cbufq_spsc_enq(cbufq_spsc_t *spsc, cbuf_t *cbuf);
+extern size_t cbufq_spsc_enq_batch(cbufq_spsc_t *spsc, cbuf_t **cbufs,
+    size_t count);
+extern cbuf_t *cbufq_spsc_deq(cbufq_spsc_t *spsc);
+extern size_t cbufq_spsc_deq_batch(cbufq_spsc_t *spsc, cbuf_t **cbufs,
+    size_t count);
+
+extern size_t cbufq_spsc_available(cbufq_spsc_t *spsc);
+extern size_t cbufq_spsc_count(cbufq_spsc_t *spsc);
+
+extern int cbufq_spsc_fd(cbufq_spsc_t *spsc);
+extern void cbufq_spsc_fd_clear(cbufq_spsc_t *spsc);
+
+/*
+ * MULTIPLE-PRODUCER, SINGLE-CONSUMER QUEUES
+ *
+ * An unbounded, lock-free queue into which any number of threads may enqueue
+ * buffers while one thread dequeues them.  Enqueueing never fails or blocks.
+ * As with cbufq_enq(), buffers must be at position 0 when enqueued.
+ *
+ * The consumer may take buffers one at a time with cbufq_mpsc_deq(), or move
+ * everything that is pending onto the tail of an ordinary queue with
+ * cbufq_mpsc_splice(), which returns the number of buffers moved.  A buffer
+ * whose enqueue is still in progress in another thread may not be seen until
+ * a later call.
+ */
+extern int cbufq_mpsc_alloc(cbufq_mpsc_t **mpscp);
+extern void cbufq_mpsc_free(cbufq_mpsc_t *mpsc);
+
+extern void cbufq_mpsc_enq(cbufq_mpsc_t *mpsc, cbuf_t *cbuf);
+extern cbuf_t *cbufq_mpsc_deq(cbufq_mpsc_t *mpsc);
+extern size_t cbufq_mpsc_splice(cbufq_mpsc_t *mpsc, cbufq_t *cbufq);
+
+/*
+ * KERNEL ZERO-COPY TRANSFER
+ *
+ * cbuf_sys_sendfile() copies data from a file to another descriptor with
+ * sendfile(2), without passing it through a buffer.
+ *
+ * cbuf_sys_vmsplice() consumes data from a buffer into the write end of a
+ * pipe with vmsplice(2).  The pipe refers to the memory of the buffer rather
+ * than a copy of it, so the consumed bytes must not be modified, and the
+ * buffer must not be freed, until they have been read out of the pipe.
+ *
+ * A splice handle owns a pipe through which cbuf_sys_splice() moves data
+ * between two descriptors with splice(2), and through which
+ * cbufq_sys_vmsplice() writes data from a queue to a descriptor.  Bytes that
+ * could not be written to "out_fd" are kept in the pipe, and are written
+ * first by the next call; cbuf_splice_pending() reports how many there are.
+ * Bytes from a queue remain in the queue until they have been written to
+ * "out_fd", and are then consumed exactly as by cbufq_sys_writev().  While
+ * any are pending, the queue must not otherwise be consumed from, and the
+ * handle may not be used with another queue or with cbuf_sys_splice() (which
+ * fail with EBUSY).
+ *
+ * Some descriptors, notably sockets, continue to refer to vmspliced memory
+ * after the bytes have been written to them.  cbufq_sys_vmsplice() therefore
+ * holds a reference (see cbuf_slice()) to each range it places in the pipe,
+ * which keeps the memory from being freed or reused.  Once the receiver of
+ * the data is known to be finished with it, cbuf_splice_release() drops the
+ * references for all bytes that have left the pipe.  The held buffers are
+ * shared, so the queue will not write over them; the caller must not either.
+ * Buffers with embedded storage (small buffers, and those from a pool) cannot
+ * be shared without copying all of it, so just the bytes placed in the pipe
+ * are copied instead, as an ordinary write would copy them.
+ */
+extern int cbuf_sys_sendfile(int out_fd, int in_fd, off_t *offset,
+    size_t want, size_t *actual);
+extern int cbuf_sys_vmsplice(cbuf_t *cbuf, int pipe_fd, size_t want,
+    size_t *actual);
+
+extern int cbuf_splice_alloc(cbuf_splice_t **spp);
+extern void cbuf_splice_free(cbuf_splice_t *sp);
+extern size_t cbuf_splice_pending(cbuf_splice_t *sp);
+extern void cbuf_splice_release(cbuf_splice_t *sp);
+
+extern int cbuf_sys_splice(cbuf_splice_t *sp, int in_fd, int out_fd,
+    size_t want, size_t *actual);
+extern int cbufq_sys_vmsplice(cbufq_t *cbufq, cbuf_splice_t *sp, int out_fd,
+    size_t *actual);
+
+/*
+ * ASYNCHRONOUS I/O WITH IO_URING
+ *
+ * The submit functions queue the same operations as cbuf_sys_read(),
+ * cbuf_sys_write(), cbuf_sys_recvfrom() (without an address) and
+ * cbuf_sys_send(), and cbufq_sys_writev(), to be started by the kernel.  They
+ * fail with EAGAIN if too many operations are already in flight.  Queued
+ * operations are passed to the kernel in a batch by cbuf_uring_submit(), or
+ * by cbuf_uring_reap().  A buffer or queue must not be used in any other way
+ * until its operation has completed.
+ *
+ * cbuf_uring_reap() submits any queued operations and collects up to "max"
+ * completions, first waiting until at least "wait" are available.  The
+ * position of each buffer, or the contents of each queue, is updated just as
+ * by the synchronous call.  Each event carries the "arg" given at
+ * submission, the number of bytes transferred, and the errno value if the
+ * operation failed.
+ *
+ * cbuf_uring_register() registers the backing store of a set of buffers with
+ * the kernel, once per ring.  Reads and writes that fall within registered
+ * memory then use fixed buffers, which avoids mapping the pages for each
+ * operation.  Pool buffers (see cbuf_pool_alloc()) keep their backing store
+ * when freed, so a set of buffers allocated from a pool, registered, and then
+ * freed again makes later allocations from that pool eligible.  Registered
+ * memory must remain allocated until the ring is freed.
+ */
+typedef struct cbuf_uring_event {
+	cbuf_t *cbue_cbuf;		/* NULL for a queue */
+	cbufq_t *cbue_cbufq;		/* NULL for a buffer */
+	void *cbue_arg;
+	int cbue_error;			/* errno value, or 0 on success */
+	size_t cbue_actual;		/* bytes transferred */
+} cbuf_uring_event_t;
+
+extern int cbuf_uring_alloc(cbuf_uring_t **ringp, unsigned int entries);
+extern void cbuf_uring_free(cbuf_uring_t *ring);
+extern int cbuf_uring_register(cbuf_uring_t *ring, cbuf_t **cbufs,
+    unsigned int ncbufs);
+
+extern int cbuf_uring_submit_read(cbuf_uring_t *ring, cbuf_t *cbuf, int fd,
+    size_t want, void *arg);
+extern int cbuf_uring_submit_write(cbuf_uring_t *ring, cbuf_t *cbuf, int fd,
+    size_t want, void *arg);
+extern int cbuf_uring_submit_recv(cbuf_uring_t *ring, cbuf_t *cbuf, int fd,
+    size_t want, int flags, void *arg);
+extern int cbuf_uring_submit_send(cbuf_uring_t *ring, cbuf_t *cbuf, int fd,
+    size_t want, int flags, void *arg);
+extern int cbufq_uring_submit_writev(cbuf_uring_t *ring, cbufq_t *cbufq,
+    int fd, void *arg);
+
+extern int cbuf_uring_submit(cbuf_uring_t *ring, unsigned int *submitted);
+extern int cbuf_uring_reap(cbuf_uring_t *ring, cbuf_uring_event_t *events,
+    unsigned int max, unsigned int wait, unsigned int *reaped);
+
+/*
+ * ZERO-COPY SENDS
+ *
+ * cbuf_zc_alloc() enables SO_ZEROCOPY on a connected socket.  The socket must
+ * not be used for MSG_ZEROCOPY sends other than through this handle.
+ * cbufq_zc_send() consumes data from a queue as cbufq_sys_sendmsg() does.  If
+ * at least "threshold" bytes are available, the data is sent with
+ * MSG_ZEROCOPY; otherwise (or if the kernel has no room to pin more memory)
+ * it is copied by an ordinary send.
+ *
+ * The kernel reads zero-copy data from the memory of the buffers after the
+ * send has returned.  Each range sent is therefore held on an in-flight queue
+ * (as a slice, see cbuf_slice(), or as a copy; see below), which keeps the
+ * memory from being freed, reused or (by the queue) written over.
+ * Completions arrive on the socket error queue, which makes the socket
+ * poll(2) with POLLERR.  cbuf_zc_reap() reads them without blocking, releases
+ * the holds of each completed send (in order), and reports how many sends
+ * were released.
+ * cbuf_zc_inflight() is the number of bytes still held, and cbuf_zc_copied()
+ * counts sends for which the kernel made a copy anyway; e.g., those to a
+ * local peer.  Buffers with embedded storage (small buffers, and those from a
+ * pool) cannot be sliced without copying all of it, so just the bytes sent
+ * from them are held as a copy instead, as an ordinary send would copy them;
+ * the rest of the send is still made without a copy.
+ *
+ * cbuf_zc_free() must not be called while any sends are in flight: the
+ * caller must first call cbuf_zc_reap() until cbuf_zc_inflight() is 0,
+ * waiting for POLLERR on the socket in between.
+ */
+extern int cbuf_zc_alloc(cbuf_zc_t **zcp, int fd, size_t threshold);
+extern void cbuf_zc_free(cbuf_zc_t *zc);
+
+extern int cbufq_zc_send(cbuf_zc_t *zc, cbufq_t *cbufq, int flags,
+    size_t *actual);
+extern int cbuf_zc_reap(cbuf_zc_t *zc, unsigned int *completed);
+
+extern size_t cbuf_zc_inflight(cbuf_zc_t *zc);
+extern uint64_t cbuf_zc_copied(cbuf_zc_t *zc);
+
+/*
+ * STATISTICS
+ *
+ * When the library is built with CBUF_STATS defined (e.g., "make
+ * EXTRA_CFLAGS=-DCBUF_STATS"), it counts the work it does behind the
+ * caller's back: buffers allocated and freed, bytes moved by compaction,
+ * bytes copied by cbufq_pullup(), calls which reallocate a backing store
+ * (and the size of the new allocation), and, for each system call wrapper,
+ * the number of calls, the number which failed, and the number which
+ * transferred fewer bytes than were asked for (or, for cbuf_sys_recvmmsg()
+ * and cbufq_sys_sendmmsg(), fewer messages).  For cbuf_sys_splice() and
+ * cbufq_sys_vmsplice(), each system call which moves data into or out of the
+ * pipe is counted.
+ *
+ * Each thread updates counters of its own, without atomic operations.
+ * cbuf_stats_snapshot() adds together the counters of every thread,
+ * including those that have exited, so a snapshot taken while other threads
+ * are using the library is not an exact point in time.  In a library built
+ * without CBUF_STATS, cbuf_stats_snapshot() fails with ENOTSUP.
+ */
+typedef enum cbuf_stat_sys {
+	CBUF_STAT_SYS_READ = 0,		/* cbuf_sys_read() */
+	CBUF_STAT_SYS_WRITE,		/* cbuf_sys_write() */
+	CBUF_STAT_SYS_SEND,		/* cbuf_sys_send() */
+	CBUF_STAT_SYS_SENDTO,		/* cbuf_sys_sendto() */
+	CBUF_STAT_SYS_RECVFROM,		/* cbuf_sys_recvfrom() */
+	CBUF_STAT_SYS_READV,		/* cbufq_sys_readv() */
+	CBUF_STAT_SYS_WRITEV,		/* cbufq_sys_writev() */
+	CBUF_STAT_SYS_SENDMSG,		/* cbufq_sys_sendmsg() */
+	CBUF_STAT_SYS_SENDFILE,		/* cbuf_sys_sendfile() */
+	CBUF_STAT_SYS_VMSPLICE,		/* cbuf_sys_vmsplice() */
+	CBUF_STAT_SYS_SPLICE,		/* cbuf_sys_splice() */
+	CBUF_STAT_SYS_QVMSPLICE,	/* cbufq_sys_vmsplice() */
+	CBUF_STAT_SYS_RECVMMSG,		/* cbuf_sys_recvmmsg() */
+	CBUF_STAT_SYS_SENDMMSG,		/* cbufq_sys_sendmmsg() */
+	CBUF_STAT_SYS_ZC_SEND,		/* cbufq_zc_send() */
+	CBUF_STAT_SYS_NTYPES
+} cbuf_stat_sys_t;
+
+typedef struct cbuf_stats_sys {
+	uint64_t cbss_calls;
+	uint64_t cbss_errors;
+	uint64_t cbss_short;		/* fewer bytes than requested */
+} cbuf_stats_sys_t;
+
+typedef struct cbuf_stats {
+	uint64_t cbs_allocs;		/* buffers allocated */
+	uint64_t cbs_frees;		/* buffers freed */
+	uint64_t cbs_reallocs;		/* backing stores reallocated */
+	uint64_t cbs_realloc_bytes;	/* new size of those backing stores */
+	uint64_t cbs_compact_bytes;	/* bytes moved by compaction */
+	uint64_t cbs_pullup_bytes;	/* bytes copied by cbufq_pullup() */
+	cbuf_stats_sys_t cbs_sys[CBUF_STAT_SYS_NTYPES];
+} cbuf_stats_t;
+
+extern int cbuf_stats_snapshot(cbuf_stats_t *stats);
+extern void cbuf_stats_dump(const cbuf_stats_t *stats, FILE *fp);
+
 #endif	/* !_LIBCBUF_H */
@@ -3,14 +3,21 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
 #include <errno.h>
+#include <limits.h>
 #include <sys/debug.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <inttypes.h>
 #include <unistd.h>
 #include "sys/list.h"
 
+#ifndef	IOV_MAX
+#define	IOV_MAX			1024
+#endif
+
 #ifdef	LIBCBUF_NO_ENDIAN_H
 /*
  * Check to make sure this is a little-endian system.
@@ -46,11 +53,32 @@
 #include <endian.h>
 #endif
 
+/*
+ * The byte order of this machine, for comparison with "cbuf_order".
+ */
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define	CBUF_ORDER_NATIVE	CBUF_ORDER_BIG_ENDIAN
+#else
+#define	CBUF_ORDER_NATIVE	CBUF_ORDER_LITTLE_ENDIAN
+#endif
+
 #include "libcbuf.h"
 
 #ifndef	_LIBCBUF_IMPL_H
 #define	_LIBCBUF_IMPL_H
 
+typedef enum cbuf_store {
+	CBUF_STORE_HEAP = 1,		/* cbuf_data is a separate malloc(3C) */
+	CBUF_STORE_EMBEDDED,		/* cbuf_data follows the cbuf_t header */
+					/* (pool or small cbuf_alloc() bufs) */
+	CBUF_STORE_RING,		/* cbuf_data is within a ring mapping */
+	CBUF_STORE_SHARED,		/* cbuf_data is within a cbuf_dblk_t */
+	CBUF_STORE_MMAP			/* cbuf_data is an mmap(2) mapping */
+} cbuf_store_t;
+
+typedef struct cbuf_pool_class cbuf_pool_class_t;
+typedef struct cbuf_dblk cbuf_dblk_t;
+
 struct cbuf {
 	uint8_t *cbuf_data;
 	size_t cbuf_capacity;
@@ -60,15 +88,298 @@ struct cbuf {
 
 	cbuf_order_t cbuf_order;
 
-	list_node_t cbuf_link;		/* cbufq_t linkage */
+	cbuf_growth_t cbuf_growth;
+	size_t cbuf_growth_max;		/* largest geometric step, or 0 */
+
+	cbuf_csum_t cbuf_csum;		/* running checksum, if any */
+	size_t cbuf_csum_start;		/* index of first byte summed */
+	size_t cbuf_csum_pos;		/* index of next byte to sum */
+	uint64_t cbuf_csum_state;	/* CRC, or partial one's comp. sum */
+
+	cbuf_store_t cbuf_store;
+	cbuf_pool_class_t *cbuf_pool_class;	/* NULL if not from a pool */
+	uint8_t *cbuf_ring_base;	/* start of the ring mapping */
+	cbuf_dblk_t *cbuf_dblk;		/* shared backing store, if any */
+	size_t cbuf_mapsz;		/* length of a CBUF_STORE_MMAP mapping */
+
+	list_node_t cbuf_link;		/* cbufq_t or pool free list linkage */
+};
+
+/*
+ * Backing store shared by several buffers, after the STREAMS data block.
+ * Each buffer with the CBUF_STORE_SHARED store holds one reference, and the
+ * storage is released with the last reference.  The data block takes over the
+ * storage from the buffer that was first sliced or duplicated, so "cbd_store"
+ * is CBUF_STORE_HEAP, CBUF_STORE_RING or CBUF_STORE_MMAP.
+ */
+struct cbuf_dblk {
+	unsigned int cbd_refs;		/* updated atomically */
+	cbuf_store_t cbd_store;
+	uint8_t *cbd_base;		/* heap allocation or mapping */
+	size_t cbd_size;		/* ring capacity (mapped twice), or */
+					/* length of an mmap(2) mapping */
+};
+
+/*
+ * Each size class in a pool keeps a free list of buffers which were allocated
+ * with the header and the backing store in a single allocation of
+ * "sizeof (cbuf_t) + cbpc_size" bytes.
+ */
+struct cbuf_pool_class {
+	cbuf_pool_t *cbpc_pool;
+	size_t cbpc_size;
+
+	size_t cbpc_outstanding;	/* buffers not on the free list */
+	list_t cbpc_free;		/* free cbuf_t, linked by cbuf_link */
 };
 
+struct cbuf_pool {
+	unsigned int cbp_nclasses;
+	cbuf_pool_class_t *cbp_classes;	/* sorted by ascending cbpc_size */
+};
+
+/*
+ * The head and tail buffers are exposed to consumers through cbufq_peek() and
+ * cbufq_peek_tail(), and their positions and limits may change at any time.
+ * The buffers between them are only ever modified by the queue itself, so we
+ * keep a running total of the bytes available in those interior buffers.  Any
+ * change to the available bytes of an interior buffer must be reflected in
+ * "cbufq_bytes".
+ */
+#define	CBUFQ_DEFAULT_BUFSIZE	8192
+
 struct cbufq {
 	size_t cbufq_count;
+	size_t cbufq_bytes;		/* bytes available in interior bufs */
+
+	cbuf_pool_t *cbufq_pool;	/* allocator for new buffers */
+	size_t cbufq_bufsize;
+	cbuf_t *cbufq_spare;		/* emptied buffer kept for reuse */
+
+	cbufq_compact_t cbufq_compact;
+	size_t cbufq_compacted;		/* bytes moved by compaction */
+
+	cbuf_growth_t cbufq_growth;	/* policy for extension by pullup */
+	size_t cbufq_growth_max;
+
+	size_t cbufq_coalesce;		/* largest buffer to copy into tail */
 
 	list_t cbufq_bufs;		/* queue of cbuf_t */
 };
 
+/*
+ * The pipe used to move data between file descriptors with splice(2).  When
+ * the pending bytes were placed in the pipe by cbufq_sys_vmsplice(), they
+ * still belong to the head of "cbsp_cbufq".  Holds (see cbuf_hold()) on every
+ * range placed in the pipe that way are kept on "cbsp_held"; the pending
+ * bytes are the last bytes on that queue.
+ */
+struct cbuf_splice {
+	int cbsp_pipe[2];
+	size_t cbsp_size;		/* pipe capacity */
+	size_t cbsp_pending;		/* bytes in the pipe */
+	cbufq_t *cbsp_cbufq;		/* queue owning pending bytes, or NULL */
+	cbufq_t *cbsp_held;		/* holds on vmspliced memory */
+};
+
+/*
+ * An io_uring instance.  The submission and completion rings are shared with
+ * the kernel.  Each operation in flight has a slot in "cbu_ops", whose index
+ * is the "user_data" of its submission; free slots are linked through
+ * "cbuo_next", with "cbu_nops" as the end of the list.
+ */
+typedef struct cbuf_uring_op {
+	cbuf_t *cbuo_cbuf;		/* buffer, or NULL for a queue */
+	cbufq_t *cbuo_cbufq;
+	size_t cbuo_position;		/* buffer position at submission */
+	struct iovec *cbuo_iov;		/* I/O vector for a queue */
+	void *cbuo_arg;
+	uint32_t cbuo_next;		/* next free slot */
+} cbuf_uring_op_t;
+
+typedef struct cbuf_uring_reg {
+	uint8_t *cbur_base;
+	size_t cbur_len;
+	unsigned int cbur_index;	/* index in the kernel's buffer table */
+} cbuf_uring_reg_t;
+
+struct cbuf_uring {
+	int cbu_fd;
+
+	void *cbu_sq_map;
+	size_t cbu_sq_mapsz;
+	uint32_t *cbu_sq_head;
+	uint32_t *cbu_sq_tail;
+	uint32_t *cbu_sq_array;
+	uint32_t cbu_sq_mask;
+	uint32_t cbu_sq_entries;
+	struct io_uring_sqe *cbu_sqes;
+	unsigned int cbu_unsubmitted;	/* entries not yet passed to kernel */
+
+	void *cbu_cq_map;
+	size_t cbu_cq_mapsz;
+	uint32_t *cbu_cq_head;
+	uint32_t *cbu_cq_tail;
+	uint32_t cbu_cq_mask;
+	struct io_uring_cqe *cbu_cqes;
+
+	cbuf_uring_op_t *cbu_ops;
+	uint32_t cbu_nops;
+	uint32_t cbu_free_op;		/* first free slot */
+
+	cbuf_uring_reg_t *cbu_regs;	/* sorted by cbur_base */
+	unsigned int cbu_nregs;
+};
+
+/*
+ * Zero-copy sends on a socket.  The kernel numbers each successful
+ * MSG_ZEROCOPY send from 0, and later reports ranges of those numbers as
+ * complete on the socket error queue.  There is one record, in a ring, for
+ * each send not yet released; the first is for send "cbzc_head_seq".  Each
+ * record counts the holds it placed on the in-flight queue.
+ */
+typedef struct cbuf_zc_rec {
+	uint32_t cbzcr_nbufs;
+	bool cbzcr_done;
+} cbuf_zc_rec_t;
+
+struct cbuf_zc {
+	int cbzc_fd;
+	size_t cbzc_threshold;
+	cbufq_t *cbzc_inflight;		/* holds on memory being sent */
+	uint64_t cbzc_copied;		/* sends the kernel copied anyway */
+
+	cbuf_zc_rec_t *cbzc_recs;
+	uint32_t cbzc_recsz;		/* ring capacity */
+	uint32_t cbzc_rhead;		/* ring index of first record */
+	uint32_t cbzc_nrecs;
+	uint32_t cbzc_head_seq;		/* send number of first record */
+};
+
+#define	CBUF_CACHE_LINE		64
+
+/*
+ * The producer and consumer of a single-producer, single-consumer queue each
+ * own one cache line of indices and byte counts, so that they do not contend
+ * on the same line.  The indices run freely and are masked to find a slot.
+ */
+struct cbufq_spsc {
+	struct {
+		uint64_t cbqsp_tail;		/* next slot to fill */
+		uint64_t cbqsp_head_cache;	/* last observed head */
+		size_t cbqsp_bytes_in;		/* total bytes enqueued */
+	} cbqs_prod __attribute__((aligned(CBUF_CACHE_LINE)));
+
+	struct {
+		uint64_t cbqsc_head;		/* next slot to empty */
+		uint64_t cbqsc_tail_cache;	/* last observed tail */
+		size_t cbqsc_bytes_out;		/* total bytes dequeued */
+	} cbqs_cons __attribute__((aligned(CBUF_CACHE_LINE)));
+
+	cbuf_t **cbqs_ring __attribute__((aligned(CBUF_CACHE_LINE)));
+	uint64_t cbqs_mask;
+	int cbqs_efd;				/* eventfd, or -1 */
+};
+
+/*
+ * A multiple-producer, single-consumer queue, after the intrusive queue
+ * described by Dmitry Vyukov.  Buffers are linked through the "list_next"
+ * member of their "cbuf_link", which is otherwise unused while the buffer is
+ * on this queue.  Producers swap themselves into "cbqm_head"; the consumer
+ * removes buffers from "cbqm_tail".  The stub node keeps the list non-empty.
+ */
+struct cbufq_mpsc {
+	list_node_t *cbqm_head __attribute__((aligned(CBUF_CACHE_LINE)));
+
+	list_node_t *cbqm_tail __attribute__((aligned(CBUF_CACHE_LINE)));
+	list_node_t cbqm_stub;
+};
+
 extern int cbuf_safe_add(size_t *, size_t, size_t);
+extern int cbuf_safe_mul(size_t *, size_t, size_t);
+
+/*
+ * Copy "count" elements from "src" to "dst", reversing the byte order of each.
+ * The buffers may be unaligned but must not overlap.
+ */
+extern void cbuf_swap16(void *dst, const void *src, size_t count);
+extern void cbuf_swap32(void *dst, const void *src, size_t count);
+extern void cbuf_swap64(void *dst, const void *src, size_t count);
+
+extern void cbuf_pool_return(cbuf_t *);
+
+extern size_t cbuf_growth_size(unsigned int, size_t, size_t, size_t);
+extern int cbuf_extend_to(cbuf_t *, size_t);
+extern void *cbuf_data_alloc(size_t, cbuf_store_t *, size_t *);
+extern void cbuf_data_free(void *, cbuf_store_t, size_t);
+
+extern bool cbuf_mmap_wanted(size_t);
+extern void *cbuf_mmap_alloc(size_t, size_t *);
+extern int cbuf_mmap_resize(cbuf_t *, size_t);
+extern void cbuf_mmap_free(void *, size_t);
+
+extern void cbuf_ring_compact(cbuf_t *);
+extern void cbuf_ring_free(cbuf_t *);
+
+extern bool cbuf_share_nocopy(const cbuf_t *);
+extern int cbuf_hold(cbuf_t *, cbuf_t **, size_t, size_t);
+extern void cbuf_dblk_rele(cbuf_dblk_t *);
+extern int cbuf_dblk_unshare(cbuf_t *, size_t);
+
+extern int cbuf_sys_size_check(cbuf_t *, size_t *);
+
+extern void cbufq_consume(cbufq_t *, size_t);
+extern void cbufq_truncate(cbufq_t *, size_t);
+extern void cbufq_drop(cbufq_t *, unsigned int);
+extern int cbufq_sys_iov(cbufq_t *, struct iovec *, int);
+
+/*
+ * Statistics (see cbuf_stats_snapshot()) are only counted when the library is
+ * built with CBUF_STATS defined; otherwise these macros expand to nothing and
+ * their arguments are not evaluated.  Each thread owns the counters returned
+ * by cbuf_stats_self(), and is the only writer of them.  The stores are
+ * atomic only so that cbuf_stats_snapshot() never reads a torn value.
+ */
+#ifdef	CBUF_STATS
+extern __thread cbuf_stats_t *cbuf_stats_tls;
+extern cbuf_stats_t *cbuf_stats_attach(void);
+extern size_t cbufq_iov_total(const struct iovec *, int);
+
+static inline cbuf_stats_t *
+cbuf_stats_self(void)
+{
+	cbuf_stats_t *cbs = cbuf_stats_tls;
+
+	return (cbs != NULL ? cbs : cbuf_stats_attach());
+}
+
+#define	CBUF_STAT_ADD(member, n)					\
+	do {								\
+		cbuf_stats_t *_cbs = cbuf_stats_self();			\
+		if (_cbs != NULL) {					\
+			__atomic_store_n(&_cbs->member,			\
+			    _cbs->member + (n), __ATOMIC_RELAXED);	\
+		}							\
+	} while (0)
+
+/*
+ * Count a call to a system call wrapper which asked for "want" bytes and got
+ * the result "ret".
+ */
+#define	CBUF_STAT_SYS(which, want, ret)					\
+	do {								\
+		ssize_t _ret = (ret);					\
+									\
+		CBUF_STAT_ADD(cbs_sys[which].cbss_calls, 1);		\
+		if (_ret < 0) {						\
+			CBUF_STAT_ADD(cbs_sys[which].cbss_errors, 1);	\
+		} else if ((size_t)_ret < (size_t)(want)) {		\
+			CBUF_STAT_ADD(cbs_sys[which].cbss_short, 1);	\
+		}							\
+	} while (0)
+#else
+#define	CBUF_STAT_ADD(member, n)	((void)0)
+#define	CBUF_STAT_SYS(which, want, ret)	((void)0)
+#endif
 
 #endif	/* !_LIBCBUF_IMPL_H */
@@ -0,0 +1,198 @@
+#ifndef	_LIBCBUF_INLINE_H
+#define	_LIBCBUF_INLINE_H
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include "libcbuf.h"
+
+/*
+ * Inline versions of the buffer accessors and the primitive get and put
+ * operations.  Each behaves exactly as the extern function of the same name
+ * without the "i"; e.g., cbufi_get_u32() is equivalent to cbuf_get_u32(), but
+ * may be inlined by the compiler.  This header is optional; the extern
+ * functions remain available.
+ *
+ * The structure below mirrors the leading members of the library's private
+ * cbuf_t, which are checked against it when the library is built.  Consumers
+ * must not modify these members directly.
+ */
+struct cbuf_inline {
+	uint8_t *cbi_data;
+	size_t cbi_capacity;
+
+	size_t cbi_limit;
+	size_t cbi_position;
+
+	cbuf_order_t cbi_order;
+};
+
+#define	CBUF_INLINE(cbuf)	((struct cbuf_inline *)(void *)(cbuf))
+
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define	CBUFI_ORDER_NATIVE	CBUF_ORDER_BIG_ENDIAN
+#else
+#define	CBUFI_ORDER_NATIVE	CBUF_ORDER_LITTLE_ENDIAN
+#endif
+
+static inline size_t
+cbufi_capacity(cbuf_t *cbuf)
+{
+	return (CBUF_INLINE(cbuf)->cbi_capacity);
+}
+
+static inline size_t
+cbufi_limit(cbuf_t *cbuf)
+{
+	return (CBUF_INLINE(cbuf)->cbi_limit);
+}
+
+static inline size_t
+cbufi_position(cbuf_t *cbuf)
+{
+	return (CBUF_INLINE(cbuf)->cbi_position);
+}
+
+static inline size_t
+cbufi_available(cbuf_t *cbuf)
+{
+	struct cbuf_inline *cbi = CBUF_INLINE(cbuf);
+
+	return (cbi->cbi_limit - cbi->cbi_position);
+}
+
+static inline size_t
+cbufi_unused(cbuf_t *cbuf)
+{
+	struct cbuf_inline *cbi = CBUF_INLINE(cbuf);
+
+	return (cbi->cbi_capacity - cbi->cbi_limit);
+}
+
+static inline int
+cbufi_skip(cbuf_t *cbuf, size_t skip_bytes)
+{
+	if (skip_bytes > cbufi_available(cbuf)) {
+		errno = ENOSPC;
+		return (-1);
+	}
+
+	CBUF_INLINE(cbuf)->cbi_position += skip_bytes;
+	return (0);
+}
+
+/*
+ * Copy "sz" bytes out of the buffer at the current position, or into the
+ * buffer at the current position, and advance the position.
+ */
+static inline int
+cbufi_get_bytes(cbuf_t *cbuf, void *val, size_t sz)
+{
+	struct cbuf_inline *cbi = CBUF_INLINE(cbuf);
+
+	if (cbi->cbi_limit - cbi->cbi_position < sz) {
+		errno = ENOSPC;
+		return (-1);
+	}
+
+	memcpy(val, &cbi->cbi_data[cbi->cbi_position], sz);
+	cbi->cbi_position += sz;
+	return (0);
+}
+
+static inline int
+cbufi_put_bytes(cbuf_t *cbuf, const void *val, size_t sz)
+{
+	struct cbuf_inline *cbi = CBUF_INLINE(cbuf);
+
+	if (cbi->cbi_limit - cbi->cbi_position < sz) {
+		errno = ENOSPC;
+		return (-1);
+	}
+
+	memcpy(&cbi->cbi_data[cbi->cbi_position], val, sz);
+	cbi->cbi_position += sz;
+	return (0);
+}
+
+static inline int
+cbufi_get_char(cbuf_t *cbuf, char *val)
+{
+	return (cbufi_get_bytes(cbuf, val, sizeof (*val)));
+}
+
+static inline int
+cbufi_get_u8(cbuf_t *cbuf, uint8_t *val)
+{
+	return (cbufi_get_bytes(cbuf, val, sizeof (*val)));
+}
+
+static inline int
+cbufi_put_char(cbuf_t *cbuf, char val)
+{
+	return (cbufi_put_bytes(cbuf, &val, sizeof (val)));
+}
+
+static inline int
+cbufi_put_u8(cbuf_t *cbuf, uint8_t val)
+{
+	return (cbufi_put_bytes(cbuf, &val, sizeof (val)));
+}
+
+#define	CBUFI_GET_SWAPPED(cbuf, val, bswap)				\
+	do {								\
+		if (cbufi_get_bytes(cbuf, val, sizeof (*val)) != 0) {	\
+			return (-1);					\
+		}							\
+		if (CBUF_INLINE(cbuf)->cbi_order != CBUFI_ORDER_NATIVE) { \
+			*val = bswap(*val);				\
+		}							\
+		return (0);						\
+	} while (0)
+
+#define	CBUFI_PUT_SWAPPED(cbuf, val, bswap)				\
+	do {								\
+		if (CBUF_INLINE(cbuf)->cbi_order != CBUFI_ORDER_NATIVE) { \
+			val = bswap(val);				\
+		}							\
+		return (cbufi_put_bytes(cbuf, &val, sizeof (val)));	\
+	} while (0)
+
+static inline int
+cbufi_get_u16(cbuf_t *cbuf, uint16_t *val)
+{
+	CBUFI_GET_SWAPPED(cbuf, val, __builtin_bswap16);
+}
+
+static inline int
+cbufi_get_u32(cbuf_t *cbuf, uint32_t *val)
+{
+	CBUFI_GET_SWAPPED(cbuf, val, __builtin_bswap32);
+}
+
+static inline int
+cbufi_get_u64(cbuf_t *cbuf, uint64_t *val)
+{
+	CBUFI_GET_SWAPPED(cbuf, val, __builtin_bswap64);
+}
+
+static inline int
+cbufi_put_u16(cbuf_t *cbuf, uint16_t val)
+{
+	CBUFI_PUT_SWAPPED(cbuf, val, __builtin_bswap16);
+}
+
+static inline int
+cbufi_put_u32(cbuf_t *cbuf, uint32_t val)
+{
+	CBUFI_PUT_SWAPPED(cbuf, val, __builtin_bswap32);
+}
+
+static inline int
+cbufi_put_u64(cbuf_t *cbuf, uint64_t val)
+{
+	CBUFI_PUT_SWAPPED(cbuf, val, __builtin_bswap64);
+}
+
+#endif	/* !_LIBCBUF_INLINE_H */
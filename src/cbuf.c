@@ -1,6 +1,22 @@
 
 #include "libcbuf_impl.h"
 #include "libcbuf.h"
+#include "libcbuf_inline.h"
+
+/*
+ * The inline accessors in "libcbuf_inline.h" depend on the layout of the
+ * leading members of cbuf_t.
+ */
+CTASSERT(offsetof(cbuf_t, cbuf_data) ==
+    offsetof(struct cbuf_inline, cbi_data));
+CTASSERT(offsetof(cbuf_t, cbuf_capacity) ==
+    offsetof(struct cbuf_inline, cbi_capacity));
+CTASSERT(offsetof(cbuf_t, cbuf_limit) ==
+    offsetof(struct cbuf_inline, cbi_limit));
+CTASSERT(offsetof(cbuf_t, cbuf_position) ==
+    offsetof(struct cbuf_inline, cbi_position));
+CTASSERT(offsetof(cbuf_t, cbuf_order) ==
+    offsetof(struct cbuf_inline, cbi_order));
 
 int
 cbuf_safe_add(size_t *res, size_t a, size_t b)
@@ -14,25 +30,98 @@ cbuf_safe_add(size_t *res, size_t a, size_t b)
 	return (0);
 }
 
+int
+cbuf_safe_mul(size_t *res, size_t a, size_t b)
+{
+	if (b != 0 && a > SIZE_MAX / b) {
+		errno = EOVERFLOW;
+		return (-1);
+	}
+
+	*res = a * b;
+	return (0);
+}
+
+/*
+ * Allocate a private backing store of "capacity" bytes: from the heap, or as
+ * a mapping of its own if the buffer is large enough.
+ */
+void *
+cbuf_data_alloc(size_t capacity, cbuf_store_t *storep, size_t *mapszp)
+{
+	if (cbuf_mmap_wanted(capacity)) {
+		*storep = CBUF_STORE_MMAP;
+		return (cbuf_mmap_alloc(capacity, mapszp));
+	}
+
+	*storep = CBUF_STORE_HEAP;
+	*mapszp = 0;
+	return (malloc(capacity));
+}
+
+void
+cbuf_data_free(void *data, cbuf_store_t store, size_t mapsz)
+{
+	switch (store) {
+	case CBUF_STORE_HEAP:
+		free(data);
+		break;
+
+	case CBUF_STORE_MMAP:
+		cbuf_mmap_free(data, mapsz);
+		break;
+
+	default:
+		abort();
+		break;
+	}
+}
+
+static size_t cbuf_inline_max = CBUF_INLINE_MAX_DEFAULT;
+
+void
+cbuf_inline_max_set(size_t inline_max)
+{
+	__atomic_store_n(&cbuf_inline_max, inline_max, __ATOMIC_RELAXED);
+}
+
 int
 cbuf_alloc(cbuf_t **cbufp, size_t capacity)
 {
+	size_t inline_max = __atomic_load_n(&cbuf_inline_max,
+	    __ATOMIC_RELAXED);
 	cbuf_t *cbuf;
 
 	*cbufp = NULL;
 
-	if ((cbuf = calloc(1, sizeof (*cbuf))) == NULL) {
-		return (-1);
+	if (inline_max != 0 && capacity <= inline_max) {
+		/*
+		 * A small buffer keeps its data just after the header, as a
+		 * pool buffer does, which saves an allocation and puts the
+		 * data in the same cache lines as the header.
+		 */
+		if ((cbuf = malloc(sizeof (*cbuf) + capacity)) == NULL) {
+			return (-1);
+		}
+		bzero(cbuf, sizeof (*cbuf));
+		cbuf->cbuf_data = (uint8_t *)(cbuf + 1);
+		cbuf->cbuf_store = CBUF_STORE_EMBEDDED;
+	} else {
+		if ((cbuf = calloc(1, sizeof (*cbuf))) == NULL) {
+			return (-1);
+		}
+		if ((cbuf->cbuf_data = cbuf_data_alloc(capacity,
+		    &cbuf->cbuf_store, &cbuf->cbuf_mapsz)) == NULL) {
+			free(cbuf);
+			return (-1);
+		}
 	}
 	cbuf->cbuf_capacity = capacity;
 	cbuf->cbuf_limit = cbuf->cbuf_capacity;
 	cbuf->cbuf_position = 0;
 	cbuf->cbuf_order = CBUF_ORDER_BIG_ENDIAN;
-
-	if ((cbuf->cbuf_data = malloc(cbuf->cbuf_capacity)) == NULL) {
-		free(cbuf);
-		return (-1);
-	}
+	cbuf->cbuf_growth = CBUF_GROWTH_EXACT;
+	CBUF_STAT_ADD(cbs_allocs, 1);
 
 	*cbufp = cbuf;
 	return (0);
@@ -46,23 +135,186 @@ cbuf_free(cbuf_t *cbuf)
 	}
 
 	VERIFY(!list_link_active(&cbuf->cbuf_link));
+	CBUF_STAT_ADD(cbs_frees, 1);
 
-	free(cbuf->cbuf_data);
+	if (cbuf->cbuf_pool_class != NULL) {
+		cbuf_pool_return(cbuf);
+		return;
+	}
+
+	switch (cbuf->cbuf_store) {
+	case CBUF_STORE_HEAP:
+	case CBUF_STORE_MMAP:
+		cbuf_data_free(cbuf->cbuf_data, cbuf->cbuf_store,
+		    cbuf->cbuf_mapsz);
+		break;
+
+	case CBUF_STORE_EMBEDDED:
+		/*
+		 * The data is part of the header allocation.
+		 */
+		break;
+
+	case CBUF_STORE_RING:
+		cbuf_ring_free(cbuf);
+		break;
+
+	case CBUF_STORE_SHARED:
+		cbuf_dblk_rele(cbuf->cbuf_dblk);
+		break;
+
+	default:
+		abort();
+		break;
+	}
 	free(cbuf);
 }
 
+void
+cbuf_growth_set(cbuf_t *cbuf, unsigned int policy, size_t max_step)
+{
+	switch (policy) {
+	case CBUF_GROWTH_EXACT:
+	case CBUF_GROWTH_GEOMETRIC:
+	case CBUF_GROWTH_POW2:
+		cbuf->cbuf_growth = policy;
+		cbuf->cbuf_growth_max = max_step;
+		break;
+
+	default:
+		abort();
+		break;
+	}
+}
+
+/*
+ * Determine the capacity to which a buffer of "capacity" bytes should be
+ * grown, under the given policy, to hold at least "want" bytes.  If the
+ * policy would overflow, the buffer is grown to exactly "want" bytes.
+ */
+size_t
+cbuf_growth_size(unsigned int policy, size_t max_step, size_t capacity,
+    size_t want)
+{
+	size_t step, size;
+
+	switch (policy) {
+	case CBUF_GROWTH_EXACT:
+		return (want);
+
+	case CBUF_GROWTH_GEOMETRIC:
+		step = capacity;
+		if (max_step != 0 && step > max_step) {
+			step = max_step;
+		}
+		if (cbuf_safe_add(&size, capacity, step) != 0) {
+			return (want);
+		}
+		return (size > want ? size : want);
+
+	case CBUF_GROWTH_POW2:
+		for (size = 1; size < want; size <<= 1) {
+			if (size > SIZE_MAX / 2) {
+				return (want);
+			}
+		}
+		return (size);
+
+	default:
+		abort();
+		break;
+	}
+}
+
 int
 cbuf_extend(cbuf_t *cbuf, size_t new_capacity)
 {
+	if (new_capacity <= cbuf->cbuf_capacity) {
+		return (0);
+	}
+
+	return (cbuf_extend_to(cbuf, cbuf_growth_size(cbuf->cbuf_growth,
+	    cbuf->cbuf_growth_max, cbuf->cbuf_capacity, new_capacity)));
+}
+
+/*
+ * Extend a buffer to exactly "new_capacity" bytes.
+ */
+int
+cbuf_extend_to(cbuf_t *cbuf, size_t new_capacity)
+{
+	cbuf_store_t store;
+	size_t mapsz;
 	void *new_data;
 
 	if (new_capacity <= cbuf->cbuf_capacity) {
 		return (0);
 	}
 
+	if (cbuf->cbuf_store == CBUF_STORE_RING) {
+		errno = ENOTSUP;
+		return (-1);
+	}
+
+	if (cbuf->cbuf_store == CBUF_STORE_SHARED) {
+		/*
+		 * Other buffers may still refer to the shared backing store,
+		 * so the data is copied to a private allocation.
+		 */
+		return (cbuf_dblk_unshare(cbuf, new_capacity));
+	}
+
+	if (cbuf->cbuf_store == CBUF_STORE_MMAP) {
+		if (cbuf_mmap_resize(cbuf, new_capacity) != 0) {
+			return (-1);
+		}
+		CBUF_STAT_ADD(cbs_reallocs, 1);
+		CBUF_STAT_ADD(cbs_realloc_bytes, new_capacity);
+		return (0);
+	}
+
+	if (cbuf->cbuf_store == CBUF_STORE_EMBEDDED) {
+		if (cbuf->cbuf_pool_class != NULL &&
+		    new_capacity <= cbuf->cbuf_pool_class->cbpc_size) {
+			/*
+			 * The embedded backing store is already large enough.
+			 */
+			cbuf->cbuf_capacity = new_capacity;
+			return (0);
+		}
+	}
+
+	if (cbuf->cbuf_store == CBUF_STORE_EMBEDDED ||
+	    cbuf_mmap_wanted(new_capacity)) {
+		/*
+		 * Embedded backing store is part of the header allocation, so
+		 * we cannot realloc(3C) it, and a heap buffer which has become
+		 * large enough moves to a mapping of its own.  Either way, the
+		 * data is copied to a new backing store.
+		 */
+		if ((new_data = cbuf_data_alloc(new_capacity, &store,
+		    &mapsz)) == NULL) {
+			return (-1);
+		}
+		memcpy(new_data, cbuf->cbuf_data, cbuf->cbuf_capacity);
+		CBUF_STAT_ADD(cbs_reallocs, 1);
+		CBUF_STAT_ADD(cbs_realloc_bytes, new_capacity);
+
+		if (cbuf->cbuf_store == CBUF_STORE_HEAP) {
+			free(cbuf->cbuf_data);
+		}
+		cbuf->cbuf_data = new_data;
+		cbuf->cbuf_capacity = new_capacity;
+		cbuf->cbuf_store = store;
+		cbuf->cbuf_mapsz = mapsz;
+		return (0);
+	}
+
 	if ((new_data = realloc(cbuf->cbuf_data, new_capacity)) == NULL) {
 		return (-1);
 	}
+	CBUF_STAT_ADD(cbs_reallocs, 1);
+	CBUF_STAT_ADD(cbs_realloc_bytes, new_capacity);
 
 	cbuf->cbuf_data = new_data;
 	cbuf->cbuf_capacity = new_capacity;
@@ -75,9 +327,34 @@ cbuf_shrink(cbuf_t *cbuf)
 {
 	void *new_data;
 
+	if (cbuf->cbuf_store == CBUF_STORE_RING) {
+		errno = ENOTSUP;
+		return (-1);
+	}
+
+	if (cbuf->cbuf_store == CBUF_STORE_EMBEDDED ||
+	    cbuf->cbuf_store == CBUF_STORE_SHARED) {
+		/*
+		 * There is no separate allocation to give back.
+		 */
+		cbuf->cbuf_capacity = cbuf->cbuf_limit;
+		return (0);
+	}
+
+	if (cbuf->cbuf_store == CBUF_STORE_MMAP) {
+		if (cbuf_mmap_resize(cbuf, cbuf->cbuf_limit) != 0) {
+			return (-1);
+		}
+		CBUF_STAT_ADD(cbs_reallocs, 1);
+		CBUF_STAT_ADD(cbs_realloc_bytes, cbuf->cbuf_limit);
+		return (0);
+	}
+
 	if ((new_data = realloc(cbuf->cbuf_data, cbuf->cbuf_limit)) == NULL) {
 		return (-1);
 	}
+	CBUF_STAT_ADD(cbs_reallocs, 1);
+	CBUF_STAT_ADD(cbs_realloc_bytes, cbuf->cbuf_limit);
 
 	cbuf->cbuf_data = new_data;
 	cbuf->cbuf_capacity = cbuf->cbuf_limit;
@@ -106,7 +383,7 @@ cbuf_byteorder_set(cbuf_t *cbuf, unsigned int order)
 	}
 }
 
-static int
+int
 cbuf_sys_size_check(cbuf_t *cbuf, size_t *want)
 {
 	if (*want == CBUF_SYSREAD_ENTIRE) {
@@ -136,8 +413,9 @@ cbuf_sys_read(cbuf_t *cbuf, int fd, size_t want, size_t *actual)
 	}
 
 	size_t pos = cbuf_position(cbuf);
-	ssize_t rsz;
-	if ((rsz = read(fd, &cbuf->cbuf_data[pos], want)) < 0) {
+	ssize_t rsz = read(fd, &cbuf->cbuf_data[pos], want);
+	CBUF_STAT_SYS(CBUF_STAT_SYS_READ, want, rsz);
+	if (rsz < 0) {
 		return (-1);
 	}
 	VERIFY0(cbuf_position_set(cbuf, pos + rsz));
@@ -159,8 +437,9 @@ cbuf_sys_send(cbuf_t *cbuf, int fd, size_t want, size_t *actual, int flags)
 	}
 
 	size_t pos = cbuf_position(cbuf);
-	ssize_t wsz;
-	if ((wsz = send(fd, &cbuf->cbuf_data[pos], want, flags)) < 0) {
+	ssize_t wsz = send(fd, &cbuf->cbuf_data[pos], want, flags);
+	CBUF_STAT_SYS(CBUF_STAT_SYS_SEND, want, wsz);
+	if (wsz < 0) {
 		return (-1);
 	}
 	VERIFY0(cbuf_position_set(cbuf, pos + wsz));
@@ -183,8 +462,9 @@ cbuf_sys_write(cbuf_t *cbuf, int fd, size_t want, size_t *actual)
 	}
 
 	size_t pos = cbuf_position(cbuf);
-	ssize_t wsz;
-	if ((wsz = write(fd, &cbuf->cbuf_data[pos], want)) < 0) {
+	ssize_t wsz = write(fd, &cbuf->cbuf_data[pos], want);
+	CBUF_STAT_SYS(CBUF_STAT_SYS_WRITE, want, wsz);
+	if (wsz < 0) {
 		return (-1);
 	}
 	VERIFY0(cbuf_position_set(cbuf, pos + wsz));
@@ -204,9 +484,10 @@ cbuf_sys_sendto(cbuf_t *cbuf, int fd, size_t want, size_t *actual,
 	}
 
 	size_t pos = cbuf_position(cbuf);
-	ssize_t wsz;
-	if ((wsz = sendto(fd, &cbuf->cbuf_data[pos], want, flags, to,
-	    tolen)) < 0) {
+	ssize_t wsz = sendto(fd, &cbuf->cbuf_data[pos], want, flags, to,
+	    tolen);
+	CBUF_STAT_SYS(CBUF_STAT_SYS_SENDTO, want, wsz);
+	if (wsz < 0) {
 		return (-1);
 	}
 	VERIFY0(cbuf_position_set(cbuf, pos + wsz));
@@ -226,9 +507,10 @@ cbuf_sys_recvfrom(cbuf_t *cbuf, int fd, size_t want, size_t *actual,
 	}
 
 	size_t pos = cbuf_position(cbuf);
-	ssize_t rsz;
-	if ((rsz = recvfrom(fd, &cbuf->cbuf_data[pos], want, flags,
-	    from, fromlen)) < 0) {
+	ssize_t rsz = recvfrom(fd, &cbuf->cbuf_data[pos], want, flags,
+	    from, fromlen);
+	CBUF_STAT_SYS(CBUF_STAT_SYS_RECVFROM, want, rsz);
+	if (rsz < 0) {
 		return (-1);
 	}
 	VERIFY0(cbuf_position_set(cbuf, pos + rsz));
@@ -352,7 +634,26 @@ cbuf_compact(cbuf_t *cbuf)
 		return;
 	}
 
+	if (cbuf->cbuf_store == CBUF_STORE_RING) {
+		cbuf_ring_compact(cbuf);
+		return;
+	}
+
+	if (cbuf->cbuf_store == CBUF_STORE_SHARED) {
+		/*
+		 * Other buffers may refer to the bytes before the position, so
+		 * rather than moving the data, move the start of this buffer.
+		 */
+		cbuf->cbuf_data += start;
+		cbuf->cbuf_capacity -= start;
+		cbuf->cbuf_position = 0;
+		VERIFY3U(cbuf->cbuf_limit, >=, start);
+		cbuf->cbuf_limit -= start;
+		return;
+	}
+
 	memmove(&cbuf->cbuf_data[0], &cbuf->cbuf_data[start], copysz);
+	CBUF_STAT_ADD(cbs_compact_bytes, copysz);
 	cbuf->cbuf_position = 0;
 	VERIFY3U(cbuf->cbuf_limit, >=, start);
 	cbuf->cbuf_limit -= start;
@@ -443,6 +744,73 @@ cbuf_put_u64(cbuf_t *cbuf, uint64_t val)
 	CBUF_APPEND_COMMON(cbuf, val);
 }
 
+/*
+ * Transfer an array of values between the buffer and memory.  The byte order
+ * is only reversed when the buffer order differs from that of the machine.
+ */
+#define	CBUF_ARRAY_COMMON(cbuf, get, vals, count, swapfunc)		\
+	do {								\
+		size_t sz;						\
+									\
+		if (cbuf_safe_mul(&sz, count, sizeof (*vals)) != 0 ||	\
+		    cbuf_available(cbuf) < sz) {			\
+			errno = ENOSPC;					\
+			return (-1);					\
+		}							\
+									\
+		uint8_t *p = &cbuf->cbuf_data[cbuf->cbuf_position];	\
+		void *dst = (get) ? (void *)vals : (void *)p;		\
+		const void *src = (get) ? (const void *)p :		\
+		    (const void *)vals;					\
+									\
+		if (cbuf->cbuf_order == CBUF_ORDER_NATIVE) {		\
+			memcpy(dst, src, sz);				\
+		} else {						\
+			swapfunc(dst, src, count);			\
+		}							\
+									\
+		cbuf->cbuf_position += sz;				\
+		VERIFY(cbuf->cbuf_position <= cbuf->cbuf_limit);	\
+									\
+		return (0);						\
+	} while (0)
+
+int
+cbuf_get_u16v(cbuf_t *cbuf, uint16_t *vals, size_t count)
+{
+	CBUF_ARRAY_COMMON(cbuf, true, vals, count, cbuf_swap16);
+}
+
+int
+cbuf_get_u32v(cbuf_t *cbuf, uint32_t *vals, size_t count)
+{
+	CBUF_ARRAY_COMMON(cbuf, true, vals, count, cbuf_swap32);
+}
+
+int
+cbuf_get_u64v(cbuf_t *cbuf, uint64_t *vals, size_t count)
+{
+	CBUF_ARRAY_COMMON(cbuf, true, vals, count, cbuf_swap64);
+}
+
+int
+cbuf_put_u16v(cbuf_t *cbuf, const uint16_t *vals, size_t count)
+{
+	CBUF_ARRAY_COMMON(cbuf, false, vals, count, cbuf_swap16);
+}
+
+int
+cbuf_put_u32v(cbuf_t *cbuf, const uint32_t *vals, size_t count)
+{
+	CBUF_ARRAY_COMMON(cbuf, false, vals, count, cbuf_swap32);
+}
+
+int
+cbuf_put_u64v(cbuf_t *cbuf, const uint64_t *vals, size_t count)
+{
+	CBUF_ARRAY_COMMON(cbuf, false, vals, count, cbuf_swap64);
+}
+
 int
 cbuf_get_u8(cbuf_t *cbuf, uint8_t *val)
 {
@@ -458,6 +826,25 @@ cbuf_get_u8(cbuf_t *cbuf, uint8_t *val)
 	return (0);
 }
 
+int
+cbuf_get_u16(cbuf_t *cbuf, uint16_t *val)
+{
+	if (cbuf_available(cbuf) < 2) {
+		errno = ENOSPC;
+		return (-1);
+	}
+
+	uint16_t ival;
+	memcpy(&ival, &cbuf->cbuf_data[cbuf->cbuf_position], sizeof (*val));
+	cbuf->cbuf_position += 2;
+	VERIFY3U(cbuf->cbuf_position, <=, cbuf->cbuf_limit);
+
+	*val = (cbuf->cbuf_order == CBUF_ORDER_BIG_ENDIAN) ? be16toh(ival) :
+	    le16toh(ival);
+
+	return (0);
+}
+
 int
 cbuf_get_u32(cbuf_t *cbuf, uint32_t *val)
 {
@@ -477,6 +864,25 @@ cbuf_get_u32(cbuf_t *cbuf, uint32_t *val)
 	return (0);
 }
 
+int
+cbuf_get_u64(cbuf_t *cbuf, uint64_t *val)
+{
+	if (cbuf_available(cbuf) < 8) {
+		errno = ENOSPC;
+		return (-1);
+	}
+
+	uint64_t ival;
+	memcpy(&ival, &cbuf->cbuf_data[cbuf->cbuf_position], sizeof (*val));
+	cbuf->cbuf_position += 8;
+	VERIFY3U(cbuf->cbuf_position, <=, cbuf->cbuf_limit);
+
+	*val = (cbuf->cbuf_order == CBUF_ORDER_BIG_ENDIAN) ? be64toh(ival) :
+	    le64toh(ival);
+
+	return (0);
+}
+
 int
 cbuf_get_char(cbuf_t *cbuf, char *val)
 {
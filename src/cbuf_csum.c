@@ -0,0 +1,379 @@
+#include "libcbuf_impl.h"
+#include "libcbuf.h"
+
+/*
+ * CRC-32C and Internet checksums.  On x86 we use the SSE4.2 CRC32
+ * instruction if the CPU has it, selected at runtime as for the byte-swapping
+ * kernels; otherwise, a portable slicing-by-8 table lookup is used.
+ */
+
+#if defined(__x86_64__)
+#define	CBUF_CRC_X86
+#include <immintrin.h>
+#endif
+
+#define	CBUF_CRC32C_POLY	0x82f63b78U	/* reflected Castagnoli */
+
+/*
+ * The Internet checksum is accumulated in 64 bits and folded after each run
+ * of this many bytes, which keeps the accumulator from overflowing.
+ */
+#define	CBUF_INET_BLOCK		(1U << 30)
+
+/*
+ * The CRC kernels take and return the CRC without the final inversion.
+ */
+typedef uint32_t cbuf_crc_func_t(uint32_t, const uint8_t *, size_t);
+
+static uint32_t cbuf_crc32c_table[8][256];
+
+static uint32_t
+cbuf_crc32c_portable(uint32_t crc, const uint8_t *p, size_t len)
+{
+	uint32_t (*t)[256] = cbuf_crc32c_table;
+
+	for (; len >= 8; len -= 8, p += 8) {
+		uint64_t w;
+
+		memcpy(&w, p, sizeof (w));
+		w = le64toh(w) ^ crc;
+		crc = t[7][w & 0xff] ^ t[6][(w >> 8) & 0xff] ^
+		    t[5][(w >> 16) & 0xff] ^ t[4][(w >> 24) & 0xff] ^
+		    t[3][(w >> 32) & 0xff] ^ t[2][(w >> 40) & 0xff] ^
+		    t[1][(w >> 48) & 0xff] ^ t[0][w >> 56];
+	}
+
+	for (; len > 0; len--, p++) {
+		crc = t[0][(crc ^ *p) & 0xff] ^ (crc >> 8);
+	}
+
+	return (crc);
+}
+
+#ifdef	CBUF_CRC_X86
+__attribute__((target("sse4.2")))
+static uint32_t
+cbuf_crc32c_sse42(uint32_t crc, const uint8_t *p, size_t len)
+{
+	uint64_t c = crc;
+
+	for (; len >= 8; len -= 8, p += 8) {
+		uint64_t w;
+
+		memcpy(&w, p, sizeof (w));
+		c = _mm_crc32_u64(c, w);
+	}
+
+	for (; len > 0; len--, p++) {
+		c = _mm_crc32_u8((uint32_t)c, *p);
+	}
+
+	return ((uint32_t)c);
+}
+#endif	/* CBUF_CRC_X86 */
+
+static cbuf_crc_func_t *cbuf_crc32c_impl;
+
+static void
+cbuf_crc32c_table_init(void)
+{
+	for (unsigned int i = 0; i < 256; i++) {
+		uint32_t crc = i;
+
+		for (unsigned int b = 0; b < 8; b++) {
+			crc = (crc >> 1) ^ (CBUF_CRC32C_POLY & -(crc & 1));
+		}
+		cbuf_crc32c_table[0][i] = crc;
+	}
+
+	for (unsigned int k = 1; k < 8; k++) {
+		for (unsigned int i = 0; i < 256; i++) {
+			uint32_t prev = cbuf_crc32c_table[k - 1][i];
+
+			cbuf_crc32c_table[k][i] = (prev >> 8) ^
+			    cbuf_crc32c_table[0][prev & 0xff];
+		}
+	}
+}
+
+/*
+ * Choose the kernel to use on this CPU.  Racing threads will all make the
+ * same choice (and build the same table), so no locking is required.
+ */
+static void
+cbuf_crc32c_init(void)
+{
+	cbuf_crc_func_t *f = cbuf_crc32c_portable;
+
+#ifdef	CBUF_CRC_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse4.2")) {
+		f = cbuf_crc32c_sse42;
+	}
+#endif
+
+	if (f == cbuf_crc32c_portable) {
+		cbuf_crc32c_table_init();
+	}
+
+	__atomic_store_n(&cbuf_crc32c_impl, f, __ATOMIC_RELEASE);
+}
+
+static uint32_t
+cbuf_crc32c_update(uint32_t crc, const uint8_t *p, size_t len)
+{
+	cbuf_crc_func_t *f;
+
+	if ((f = __atomic_load_n(&cbuf_crc32c_impl, __ATOMIC_ACQUIRE)) ==
+	    NULL) {
+		cbuf_crc32c_init();
+		f = cbuf_crc32c_impl;
+	}
+
+	return (~f(~crc, p, len));
+}
+
+/*
+ * Fold a one's complement sum down to 16 bits.
+ */
+static uint16_t
+cbuf_inet_fold(uint64_t sum)
+{
+	while (sum > 0xffff) {
+		sum = (sum & 0xffff) + (sum >> 16);
+	}
+
+	return ((uint16_t)sum);
+}
+
+/*
+ * Add "len" bytes to a folded one's complement sum.  Words are summed in the
+ * byte order of the machine, which gives the same result once the sum is
+ * stored in memory (RFC 1071, section 2).  If the bytes start at an odd
+ * offset in the checksummed data, each of their words straddles a word of
+ * the data, so the bytes of their sum are swapped.
+ */
+static uint16_t
+cbuf_inet_add(uint16_t sum, const uint8_t *p, size_t len, bool odd)
+{
+	uint64_t acc = 0;
+
+	while (len > 0) {
+		size_t run = (len < CBUF_INET_BLOCK) ? len : CBUF_INET_BLOCK;
+
+		len -= run;
+		for (; run >= 4; run -= 4, p += 4) {
+			uint32_t w;
+
+			memcpy(&w, p, sizeof (w));
+			acc += w;
+		}
+		if (run >= 2) {
+			uint16_t w;
+
+			memcpy(&w, p, sizeof (w));
+			acc += w;
+			run -= 2;
+			p += 2;
+		}
+		if (run > 0) {
+			/*
+			 * A trailing odd byte is padded with a zero byte.
+			 */
+			uint16_t w = 0;
+
+			memcpy(&w, p, 1);
+			acc += w;
+			p++;
+		}
+		acc = cbuf_inet_fold(acc);
+	}
+
+	uint16_t part = (uint16_t)acc;
+	if (odd) {
+		part = __builtin_bswap16(part);
+	}
+
+	return (cbuf_inet_fold((uint64_t)sum + part));
+}
+
+/*
+ * Convert a folded sum into the checksum, as a value to be stored in
+ * big-endian byte order.
+ */
+static uint16_t
+cbuf_inet_finish(uint16_t sum)
+{
+	return (be16toh((uint16_t)~sum));
+}
+
+/*
+ * Add "len" bytes to the state of a checksum of the given kind, for which
+ * "done" bytes have already been summed.
+ */
+static uint64_t
+cbuf_csum_add(cbuf_csum_t kind, uint64_t state, size_t done,
+    const uint8_t *p, size_t len)
+{
+	switch (kind) {
+	case CBUF_CSUM_CRC32C:
+		return (cbuf_crc32c_update((uint32_t)state, p, len));
+
+	case CBUF_CSUM_INET:
+		return (cbuf_inet_add((uint16_t)state, p, len,
+		    (done & 1) != 0));
+
+	default:
+		abort();
+		break;
+	}
+}
+
+static int
+cbuf_csum_range(cbuf_t *cbuf, size_t offset, size_t len, cbuf_csum_t kind,
+    uint64_t *statep)
+{
+	size_t end;
+
+	if (cbuf_safe_add(&end, offset, len) != 0) {
+		return (-1);
+	}
+	if (end > cbuf->cbuf_limit) {
+		errno = EOVERFLOW;
+		return (-1);
+	}
+
+	*statep = cbuf_csum_add(kind, *statep, 0, &cbuf->cbuf_data[offset],
+	    len);
+	return (0);
+}
+
+/*
+ * Sum the first "len" bytes available in a queue, one buffer at a time.
+ */
+static int
+cbufq_csum_range(cbufq_t *cbufq, size_t len, cbuf_csum_t kind,
+    uint64_t *statep)
+{
+	size_t done = 0;
+
+	if (len > cbufq_available(cbufq)) {
+		errno = ENODATA;
+		return (-1);
+	}
+
+	for (cbuf_t *cbuf = list_head(&cbufq->cbufq_bufs); done < len;
+	    cbuf = list_next(&cbufq->cbufq_bufs, cbuf)) {
+		VERIFY3P(cbuf, !=, NULL);
+
+		size_t take = cbuf_available(cbuf);
+		if (take > len - done) {
+			take = len - done;
+		}
+
+		*statep = cbuf_csum_add(kind, *statep, done,
+		    &cbuf->cbuf_data[cbuf->cbuf_position], take);
+		done += take;
+	}
+
+	return (0);
+}
+
+int
+cbuf_crc32c(cbuf_t *cbuf, size_t offset, size_t len, uint32_t *crcp)
+{
+	uint64_t state = *crcp;
+
+	if (cbuf_csum_range(cbuf, offset, len, CBUF_CSUM_CRC32C,
+	    &state) != 0) {
+		return (-1);
+	}
+
+	*crcp = (uint32_t)state;
+	return (0);
+}
+
+int
+cbufq_crc32c(cbufq_t *cbufq, size_t len, uint32_t *crcp)
+{
+	uint64_t state = *crcp;
+
+	if (cbufq_csum_range(cbufq, len, CBUF_CSUM_CRC32C, &state) != 0) {
+		return (-1);
+	}
+
+	*crcp = (uint32_t)state;
+	return (0);
+}
+
+int
+cbuf_inet_csum(cbuf_t *cbuf, size_t offset, size_t len, uint16_t *csump)
+{
+	uint64_t state = 0;
+
+	if (cbuf_csum_range(cbuf, offset, len, CBUF_CSUM_INET, &state) != 0) {
+		return (-1);
+	}
+
+	*csump = cbuf_inet_finish((uint16_t)state);
+	return (0);
+}
+
+int
+cbufq_inet_csum(cbufq_t *cbufq, size_t len, uint16_t *csump)
+{
+	uint64_t state = 0;
+
+	if (cbufq_csum_range(cbufq, len, CBUF_CSUM_INET, &state) != 0) {
+		return (-1);
+	}
+
+	*csump = cbuf_inet_finish((uint16_t)state);
+	return (0);
+}
+
+void
+cbuf_csum_start(cbuf_t *cbuf, unsigned int kind)
+{
+	switch (kind) {
+	case CBUF_CSUM_NONE:
+	case CBUF_CSUM_CRC32C:
+	case CBUF_CSUM_INET:
+		cbuf->cbuf_csum = kind;
+		break;
+
+	default:
+		abort();
+		break;
+	}
+
+	cbuf->cbuf_csum_start = cbuf->cbuf_position;
+	cbuf->cbuf_csum_pos = cbuf->cbuf_position;
+	cbuf->cbuf_csum_state = 0;
+}
+
+int
+cbuf_csum_value(cbuf_t *cbuf, uint32_t *valp)
+{
+	if (cbuf->cbuf_csum == CBUF_CSUM_NONE ||
+	    cbuf->cbuf_position < cbuf->cbuf_csum_pos) {
+		errno = EINVAL;
+		return (-1);
+	}
+
+	/*
+	 * Fold in the bytes put since we last looked.
+	 */
+	cbuf->cbuf_csum_state = cbuf_csum_add(cbuf->cbuf_csum,
+	    cbuf->cbuf_csum_state, cbuf->cbuf_csum_pos - cbuf->cbuf_csum_start,
+	    &cbuf->cbuf_data[cbuf->cbuf_csum_pos],
+	    cbuf->cbuf_position - cbuf->cbuf_csum_pos);
+	cbuf->cbuf_csum_pos = cbuf->cbuf_position;
+
+	if (cbuf->cbuf_csum == CBUF_CSUM_INET) {
+		*valp = cbuf_inet_finish((uint16_t)cbuf->cbuf_csum_state);
+	} else {
+		*valp = (uint32_t)cbuf->cbuf_csum_state;
+	}
+	return (0);
+}
@@ -0,0 +1,242 @@
+#include <sys/mman.h>
+
+#include "libcbuf_impl.h"
+#include "libcbuf.h"
+
+/*
+ * Move the backing store of a buffer into a new data block, so that other
+ * buffers may refer to it.  Heap, ring and mapped storage is handed over as
+ * it is.  Embedded storage is part of the header allocation and cannot
+ * outlive it, so it is copied to the heap instead; this happens only once
+ * per buffer.
+ */
+static int
+cbuf_share(cbuf_t *cbuf)
+{
+	cbuf_dblk_t *dblk;
+
+	if (cbuf->cbuf_store == CBUF_STORE_SHARED) {
+		return (0);
+	}
+
+	if ((dblk = calloc(1, sizeof (*dblk))) == NULL) {
+		return (-1);
+	}
+
+	switch (cbuf->cbuf_store) {
+	case CBUF_STORE_HEAP:
+		dblk->cbd_store = CBUF_STORE_HEAP;
+		dblk->cbd_base = cbuf->cbuf_data;
+		break;
+
+	case CBUF_STORE_RING:
+		dblk->cbd_store = CBUF_STORE_RING;
+		dblk->cbd_base = cbuf->cbuf_ring_base;
+		dblk->cbd_size = cbuf->cbuf_capacity;
+		cbuf->cbuf_ring_base = NULL;
+		break;
+
+	case CBUF_STORE_MMAP:
+		dblk->cbd_store = CBUF_STORE_MMAP;
+		dblk->cbd_base = cbuf->cbuf_data;
+		dblk->cbd_size = cbuf->cbuf_mapsz;
+		cbuf->cbuf_mapsz = 0;
+		break;
+
+	case CBUF_STORE_EMBEDDED:
+		dblk->cbd_store = CBUF_STORE_HEAP;
+		if ((dblk->cbd_base = malloc(cbuf->cbuf_capacity)) == NULL) {
+			free(dblk);
+			return (-1);
+		}
+		memcpy(dblk->cbd_base, cbuf->cbuf_data, cbuf->cbuf_capacity);
+		CBUF_STAT_ADD(cbs_reallocs, 1);
+		CBUF_STAT_ADD(cbs_realloc_bytes, cbuf->cbuf_capacity);
+		cbuf->cbuf_data = dblk->cbd_base;
+		break;
+
+	default:
+		abort();
+		break;
+	}
+
+	dblk->cbd_refs = 1;
+	cbuf->cbuf_dblk = dblk;
+	cbuf->cbuf_store = CBUF_STORE_SHARED;
+	return (0);
+}
+
+/*
+ * Whether a buffer can be sliced without first copying its storage.  Callers
+ * that slice only to avoid a copy should copy the bytes they need instead
+ * when this is false, which is also the case for buffers from a pool.
+ */
+bool
+cbuf_share_nocopy(const cbuf_t *cbuf)
+{
+	return (cbuf->cbuf_store != CBUF_STORE_EMBEDDED);
+}
+
+/*
+ * Create a buffer which keeps "len" bytes of "cbuf", starting at "offset", in
+ * place for as long as it exists, so that the kernel may go on reading them
+ * after a system call returns.  This is a slice where that needs no copy;
+ * otherwise, only those bytes are copied into a new buffer, just as an
+ * ordinary write would copy them, and "cbuf" is left as it was.
+ */
+int
+cbuf_hold(cbuf_t *cbuf, cbuf_t **holdp, size_t offset, size_t len)
+{
+	VERIFY3U(offset, <=, cbuf->cbuf_limit);
+	VERIFY3U(len, <=, cbuf->cbuf_limit - offset);
+
+	if (cbuf_share_nocopy(cbuf)) {
+		return (cbuf_slice(cbuf, holdp, offset, len));
+	}
+
+	if (cbuf_alloc(holdp, len) != 0) {
+		return (-1);
+	}
+	memcpy((*holdp)->cbuf_data, &cbuf->cbuf_data[offset], len);
+	(*holdp)->cbuf_order = cbuf->cbuf_order;
+	return (0);
+}
+
+/*
+ * Create a new buffer header which refers to "capacity" bytes of the shared
+ * storage of "cbuf", starting at "data".
+ */
+static int
+cbuf_view(cbuf_t *cbuf, cbuf_t **viewp, uint8_t *data, size_t capacity)
+{
+	cbuf_t *view;
+
+	*viewp = NULL;
+
+	VERIFY3U(cbuf->cbuf_store, ==, CBUF_STORE_SHARED);
+
+	if ((view = calloc(1, sizeof (*view))) == NULL) {
+		return (-1);
+	}
+
+	(void) __atomic_add_fetch(&cbuf->cbuf_dblk->cbd_refs, 1,
+	    __ATOMIC_RELAXED);
+
+	view->cbuf_data = data;
+	view->cbuf_capacity = capacity;
+	view->cbuf_limit = view->cbuf_capacity;
+	view->cbuf_position = 0;
+	view->cbuf_order = cbuf->cbuf_order;
+	view->cbuf_growth = CBUF_GROWTH_EXACT;
+	view->cbuf_store = CBUF_STORE_SHARED;
+	view->cbuf_dblk = cbuf->cbuf_dblk;
+	CBUF_STAT_ADD(cbs_allocs, 1);
+
+	*viewp = view;
+	return (0);
+}
+
+int
+cbuf_slice(cbuf_t *cbuf, cbuf_t **slicep, size_t offset, size_t len)
+{
+	size_t end;
+
+	*slicep = NULL;
+
+	if (cbuf_safe_add(&end, offset, len) != 0) {
+		return (-1);
+	}
+	if (end > cbuf->cbuf_limit) {
+		errno = EOVERFLOW;
+		return (-1);
+	}
+
+	/*
+	 * Sharing embedded storage moves it, so the data pointer must only be
+	 * used afterwards.
+	 */
+	if (cbuf_share(cbuf) != 0) {
+		return (-1);
+	}
+
+	return (cbuf_view(cbuf, slicep, &cbuf->cbuf_data[offset], len));
+}
+
+int
+cbuf_dup(cbuf_t *cbuf, cbuf_t **dupp)
+{
+	cbuf_t *dup;
+
+	*dupp = NULL;
+
+	if (cbuf_share(cbuf) != 0) {
+		return (-1);
+	}
+
+	if (cbuf_view(cbuf, &dup, cbuf->cbuf_data, cbuf->cbuf_capacity) != 0) {
+		return (-1);
+	}
+	dup->cbuf_limit = cbuf->cbuf_limit;
+	dup->cbuf_position = cbuf->cbuf_position;
+
+	*dupp = dup;
+	return (0);
+}
+
+void
+cbuf_dblk_rele(cbuf_dblk_t *dblk)
+{
+	if (__atomic_sub_fetch(&dblk->cbd_refs, 1, __ATOMIC_ACQ_REL) > 0) {
+		return;
+	}
+
+	switch (dblk->cbd_store) {
+	case CBUF_STORE_HEAP:
+		free(dblk->cbd_base);
+		break;
+
+	case CBUF_STORE_RING:
+		VERIFY0(munmap(dblk->cbd_base, 2 * dblk->cbd_size));
+		break;
+
+	case CBUF_STORE_MMAP:
+		cbuf_mmap_free(dblk->cbd_base, dblk->cbd_size);
+		break;
+
+	default:
+		abort();
+		break;
+	}
+	free(dblk);
+}
+
+/*
+ * Give a buffer a private copy of its shared backing store, with the given
+ * capacity, and drop its reference on the data block.
+ */
+int
+cbuf_dblk_unshare(cbuf_t *cbuf, size_t capacity)
+{
+	cbuf_store_t store;
+	size_t mapsz;
+	void *new_data;
+
+	VERIFY3U(cbuf->cbuf_store, ==, CBUF_STORE_SHARED);
+	VERIFY3U(capacity, >=, cbuf->cbuf_capacity);
+
+	if ((new_data = cbuf_data_alloc(capacity, &store, &mapsz)) == NULL) {
+		return (-1);
+	}
+	memcpy(new_data, cbuf->cbuf_data, cbuf->cbuf_capacity);
+	CBUF_STAT_ADD(cbs_reallocs, 1);
+	CBUF_STAT_ADD(cbs_realloc_bytes, capacity);
+
+	cbuf_dblk_rele(cbuf->cbuf_dblk);
+	cbuf->cbuf_dblk = NULL;
+
+	cbuf->cbuf_data = new_data;
+	cbuf->cbuf_capacity = capacity;
+	cbuf->cbuf_store = store;
+	cbuf->cbuf_mapsz = mapsz;
+	return (0);
+}
@@ -0,0 +1,113 @@
+#define	_GNU_SOURCE
+#include <sys/mman.h>
+
+#include "libcbuf_impl.h"
+#include "libcbuf.h"
+
+static size_t cbuf_mmap_threshold = CBUF_MMAP_THRESHOLD_DEFAULT;
+
+void
+cbuf_mmap_threshold_set(size_t threshold)
+{
+	__atomic_store_n(&cbuf_mmap_threshold, threshold, __ATOMIC_RELAXED);
+}
+
+bool
+cbuf_mmap_wanted(size_t capacity)
+{
+	size_t threshold = __atomic_load_n(&cbuf_mmap_threshold,
+	    __ATOMIC_RELAXED);
+
+	return (threshold != 0 && capacity >= threshold);
+}
+
+/*
+ * The length of the mapping which holds "capacity" bytes.  An empty buffer
+ * still keeps one page, as mremap(2) cannot resize a mapping to nothing.
+ */
+static int
+cbuf_mmap_size(size_t capacity, size_t *mapszp)
+{
+	size_t pgsz = (size_t)sysconf(_SC_PAGESIZE);
+
+	if (capacity == 0) {
+		capacity = 1;
+	}
+	if (cbuf_safe_add(mapszp, capacity, pgsz - 1) != 0) {
+		return (-1);
+	}
+	*mapszp -= *mapszp % pgsz;
+	return (0);
+}
+
+static void
+cbuf_mmap_advise(void *base, size_t mapsz)
+{
+#ifdef	MADV_HUGEPAGE
+	/*
+	 * This is only advice: a kernel without transparent huge pages, or
+	 * with them disabled, backs the mapping with ordinary pages.
+	 */
+	(void) madvise(base, mapsz, MADV_HUGEPAGE);
+#endif
+}
+
+void *
+cbuf_mmap_alloc(size_t capacity, size_t *mapszp)
+{
+	size_t mapsz;
+	void *base;
+
+	if (cbuf_mmap_size(capacity, &mapsz) != 0) {
+		return (NULL);
+	}
+
+	if ((base = mmap(NULL, mapsz, PROT_READ | PROT_WRITE,
+	    MAP_PRIVATE | MAP_ANON, -1, 0)) == MAP_FAILED) {
+		return (NULL);
+	}
+	cbuf_mmap_advise(base, mapsz);
+
+	*mapszp = mapsz;
+	return (base);
+}
+
+/*
+ * Change the capacity of a buffer with the CBUF_STORE_MMAP store.  The kernel
+ * moves the pages to a new address if the mapping cannot grow in place, so
+ * the data is never copied.
+ */
+int
+cbuf_mmap_resize(cbuf_t *cbuf, size_t capacity)
+{
+	size_t mapsz;
+	void *base;
+
+	VERIFY3U(cbuf->cbuf_store, ==, CBUF_STORE_MMAP);
+
+	if (cbuf_mmap_size(capacity, &mapsz) != 0) {
+		return (-1);
+	}
+
+	if (mapsz != cbuf->cbuf_mapsz) {
+		if ((base = mremap(cbuf->cbuf_data, cbuf->cbuf_mapsz, mapsz,
+		    MREMAP_MAYMOVE)) == MAP_FAILED) {
+			return (-1);
+		}
+		if (mapsz > cbuf->cbuf_mapsz) {
+			cbuf_mmap_advise(base, mapsz);
+		}
+
+		cbuf->cbuf_data = base;
+		cbuf->cbuf_mapsz = mapsz;
+	}
+
+	cbuf->cbuf_capacity = capacity;
+	return (0);
+}
+
+void
+cbuf_mmap_free(void *base, size_t mapsz)
+{
+	VERIFY0(munmap(base, mapsz));
+}
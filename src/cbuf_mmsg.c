@@ -0,0 +1,175 @@
+#define	_GNU_SOURCE
+#include <netinet/udp.h>
+
+#include "libcbuf_impl.h"
+#include "libcbuf.h"
+
+#ifndef	SOL_UDP
+#define	SOL_UDP			IPPROTO_UDP
+#endif
+
+/*
+ * Control message space for a UDP segment size, which is an int when
+ * received (UDP_GRO) and a uint16_t when sent (UDP_SEGMENT).
+ */
+#define	CBUF_MMSG_CTLSZ		CMSG_SPACE(sizeof (int))
+
+/*
+ * Use recvmmsg(2) to receive a datagram into each buffer, starting at the
+ * position.  Each buffer that receives a datagram is flipped, ready for gets.
+ */
+int
+cbuf_sys_recvmmsg(cbuf_t **cbufs, unsigned int ncbufs, int fd, int flags,
+    cbuf_dgram_t *dgrams, unsigned int *actual)
+{
+	struct mmsghdr msgs[CBUF_MMSG_MAX];
+	struct iovec iov[CBUF_MMSG_MAX];
+	uint8_t ctl[CBUF_MMSG_MAX][CBUF_MMSG_CTLSZ]
+	    __attribute__((aligned(sizeof (size_t))));
+
+	if (ncbufs == 0) {
+		errno = EINVAL;
+		return (-1);
+	}
+	if (ncbufs > CBUF_MMSG_MAX) {
+		ncbufs = CBUF_MMSG_MAX;
+	}
+
+	bzero(msgs, ncbufs * sizeof (msgs[0]));
+	for (unsigned int i = 0; i < ncbufs; i++) {
+		cbuf_t *cbuf = cbufs[i];
+
+		if (cbuf_available(cbuf) == 0) {
+			errno = ENOSPC;
+			return (-1);
+		}
+
+		iov[i].iov_base = &cbuf->cbuf_data[cbuf->cbuf_position];
+		iov[i].iov_len = cbuf_available(cbuf);
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+
+		if (dgrams != NULL) {
+			msgs[i].msg_hdr.msg_name = &dgrams[i].cbdg_addr;
+			msgs[i].msg_hdr.msg_namelen =
+			    sizeof (dgrams[i].cbdg_addr);
+			msgs[i].msg_hdr.msg_control = ctl[i];
+			msgs[i].msg_hdr.msg_controllen = sizeof (ctl[i]);
+		}
+	}
+
+	int r = recvmmsg(fd, msgs, ncbufs, flags, NULL);
+	CBUF_STAT_SYS(CBUF_STAT_SYS_RECVMMSG, ncbufs, r);
+	if (r < 0) {
+		return (-1);
+	}
+
+	for (int i = 0; i < r; i++) {
+		cbuf_t *cbuf = cbufs[i];
+
+		VERIFY0(cbuf_position_set(cbuf, cbuf->cbuf_position +
+		    msgs[i].msg_len));
+		cbuf_flip(cbuf);
+
+		if (dgrams == NULL) {
+			continue;
+		}
+
+		struct msghdr *mh = &msgs[i].msg_hdr;
+		dgrams[i].cbdg_addrlen = mh->msg_namelen;
+		dgrams[i].cbdg_flags = mh->msg_flags;
+		dgrams[i].cbdg_segsize = 0;
+
+		/*
+		 * If the socket has UDP_GRO enabled, the kernel may have
+		 * coalesced several datagrams of the same size into this one.
+		 */
+		for (struct cmsghdr *cm = CMSG_FIRSTHDR(mh); cm != NULL;
+		    cm = CMSG_NXTHDR(mh, cm)) {
+			if (cm->cmsg_level == SOL_UDP &&
+			    cm->cmsg_type == UDP_GRO) {
+				int segsize;
+
+				memcpy(&segsize, CMSG_DATA(cm),
+				    sizeof (segsize));
+				dgrams[i].cbdg_segsize = (size_t)segsize;
+			}
+		}
+	}
+
+	if (actual != NULL) {
+		*actual = (unsigned int)r;
+	}
+	return (0);
+}
+
+/*
+ * Use sendmmsg(2) to send each buffer in the queue as a datagram.
+ */
+int
+cbufq_sys_sendmmsg(cbufq_t *cbufq, int fd, int flags,
+    const cbuf_dgram_t *dgrams, unsigned int *actual)
+{
+	struct mmsghdr msgs[CBUF_MMSG_MAX];
+	struct iovec iov[CBUF_MMSG_MAX];
+	uint8_t ctl[CBUF_MMSG_MAX][CBUF_MMSG_CTLSZ]
+	    __attribute__((aligned(sizeof (size_t))));
+	unsigned int n = 0;
+
+	for (cbuf_t *cbuf = list_head(&cbufq->cbufq_bufs); cbuf != NULL &&
+	    n < CBUF_MMSG_MAX; cbuf = list_next(&cbufq->cbufq_bufs, cbuf)) {
+		struct msghdr *mh = &msgs[n].msg_hdr;
+
+		bzero(&msgs[n], sizeof (msgs[n]));
+		iov[n].iov_base = &cbuf->cbuf_data[cbuf->cbuf_position];
+		iov[n].iov_len = cbuf_available(cbuf);
+		mh->msg_iov = &iov[n];
+		mh->msg_iovlen = 1;
+
+		if (dgrams != NULL && dgrams[n].cbdg_addrlen > 0) {
+			mh->msg_name = (void *)&dgrams[n].cbdg_addr;
+			mh->msg_namelen = dgrams[n].cbdg_addrlen;
+		}
+
+		if (dgrams != NULL && dgrams[n].cbdg_segsize > 0) {
+			/*
+			 * Have the kernel (or the NIC) split the buffer into
+			 * datagrams of the segment size.
+			 */
+			if (dgrams[n].cbdg_segsize > UINT16_MAX) {
+				errno = EINVAL;
+				return (-1);
+			}
+			uint16_t segsize = (uint16_t)dgrams[n].cbdg_segsize;
+
+			bzero(ctl[n], sizeof (ctl[n]));
+			mh->msg_control = ctl[n];
+			mh->msg_controllen = CMSG_SPACE(sizeof (segsize));
+
+			struct cmsghdr *cm = CMSG_FIRSTHDR(mh);
+			cm->cmsg_level = SOL_UDP;
+			cm->cmsg_type = UDP_SEGMENT;
+			cm->cmsg_len = CMSG_LEN(sizeof (segsize));
+			memcpy(CMSG_DATA(cm), &segsize, sizeof (segsize));
+		}
+
+		n++;
+	}
+
+	if (n == 0) {
+		errno = ENODATA;
+		return (-1);
+	}
+
+	int r = sendmmsg(fd, msgs, n, flags);
+	CBUF_STAT_SYS(CBUF_STAT_SYS_SENDMMSG, n, r);
+	if (r < 0) {
+		return (-1);
+	}
+	cbufq_drop(cbufq, (unsigned int)r);
+
+	if (actual != NULL) {
+		*actual = (unsigned int)r;
+	}
+	return (0);
+}
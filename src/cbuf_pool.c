@@ -0,0 +1,170 @@
+#include "libcbuf_impl.h"
+#include "libcbuf.h"
+
+int
+cbuf_pool_create(cbuf_pool_t **poolp, const size_t *sizes, unsigned int nsizes)
+{
+	cbuf_pool_t *pool;
+
+	*poolp = NULL;
+
+	if (nsizes == 0) {
+		errno = EINVAL;
+		return (-1);
+	}
+
+	for (unsigned int i = 0; i < nsizes; i++) {
+		size_t total;
+
+		/*
+		 * Size classes must be non-zero and strictly ascending, and
+		 * there must be room for the header in the same allocation.
+		 */
+		if (sizes[i] == 0 || (i > 0 && sizes[i] <= sizes[i - 1])) {
+			errno = EINVAL;
+			return (-1);
+		}
+		if (cbuf_safe_add(&total, sizeof (cbuf_t), sizes[i]) != 0) {
+			return (-1);
+		}
+	}
+
+	if ((pool = calloc(1, sizeof (*pool))) == NULL) {
+		return (-1);
+	}
+
+	if ((pool->cbp_classes = calloc(nsizes,
+	    sizeof (cbuf_pool_class_t))) == NULL) {
+		free(pool);
+		return (-1);
+	}
+	pool->cbp_nclasses = nsizes;
+
+	for (unsigned int i = 0; i < nsizes; i++) {
+		cbuf_pool_class_t *cbpc = &pool->cbp_classes[i];
+
+		cbpc->cbpc_pool = pool;
+		cbpc->cbpc_size = sizes[i];
+		list_create(&cbpc->cbpc_free, sizeof (cbuf_t), offsetof(cbuf_t,
+		    cbuf_link));
+	}
+
+	*poolp = pool;
+	return (0);
+}
+
+void
+cbuf_pool_destroy(cbuf_pool_t *pool)
+{
+	if (pool == NULL) {
+		return;
+	}
+
+	for (unsigned int i = 0; i < pool->cbp_nclasses; i++) {
+		cbuf_pool_class_t *cbpc = &pool->cbp_classes[i];
+		cbuf_t *cbuf;
+
+		/*
+		 * Buffers still in use would be returned to a pool that no
+		 * longer exists.
+		 */
+		VERIFY3U(cbpc->cbpc_outstanding, ==, 0);
+
+		while ((cbuf = list_remove_head(&cbpc->cbpc_free)) != NULL) {
+			VERIFY3U(cbuf->cbuf_store, ==, CBUF_STORE_EMBEDDED);
+			free(cbuf);
+		}
+		list_destroy(&cbpc->cbpc_free);
+	}
+
+	free(pool->cbp_classes);
+	free(pool);
+}
+
+int
+cbuf_pool_alloc(cbuf_pool_t *pool, cbuf_t **cbufp, size_t capacity)
+{
+	cbuf_pool_class_t *cbpc = NULL;
+	cbuf_t *cbuf;
+
+	*cbufp = NULL;
+
+	/*
+	 * Locate the smallest size class that will fit the request.
+	 */
+	for (unsigned int i = 0; i < pool->cbp_nclasses; i++) {
+		if (capacity <= pool->cbp_classes[i].cbpc_size) {
+			cbpc = &pool->cbp_classes[i];
+			break;
+		}
+	}
+
+	if (cbpc == NULL) {
+		return (cbuf_alloc(cbufp, capacity));
+	}
+
+	if ((cbuf = list_remove_head(&cbpc->cbpc_free)) == NULL) {
+		if ((cbuf = malloc(sizeof (*cbuf) + cbpc->cbpc_size)) ==
+		    NULL) {
+			return (-1);
+		}
+	}
+	cbpc->cbpc_outstanding++;
+	CBUF_STAT_ADD(cbs_allocs, 1);
+
+	/*
+	 * Whether the header is new or was used before, start from the same
+	 * zeroed state as any other buffer.  The list link of a buffer taken
+	 * from the free list is already inactive.
+	 */
+	bzero(cbuf, sizeof (*cbuf));
+	cbuf->cbuf_data = (uint8_t *)(cbuf + 1);
+	cbuf->cbuf_store = CBUF_STORE_EMBEDDED;
+	cbuf->cbuf_pool_class = cbpc;
+	cbuf->cbuf_capacity = capacity;
+	cbuf->cbuf_limit = cbuf->cbuf_capacity;
+	cbuf->cbuf_position = 0;
+	cbuf->cbuf_order = CBUF_ORDER_BIG_ENDIAN;
+	cbuf->cbuf_growth = CBUF_GROWTH_EXACT;
+
+	*cbufp = cbuf;
+	return (0);
+}
+
+/*
+ * Called by cbuf_free() to place a pool buffer back on the free list for its
+ * size class.
+ */
+void
+cbuf_pool_return(cbuf_t *cbuf)
+{
+	cbuf_pool_class_t *cbpc = cbuf->cbuf_pool_class;
+
+	VERIFY3P(cbpc, !=, NULL);
+	VERIFY3U(cbpc->cbpc_outstanding, >, 0);
+
+	if (cbuf->cbuf_store == CBUF_STORE_HEAP ||
+	    cbuf->cbuf_store == CBUF_STORE_MMAP) {
+		/*
+		 * The buffer was extended beyond its size class; discard the
+		 * private copy and restore the embedded backing store.
+		 */
+		cbuf_data_free(cbuf->cbuf_data, cbuf->cbuf_store,
+		    cbuf->cbuf_mapsz);
+		cbuf->cbuf_data = (uint8_t *)(cbuf + 1);
+		cbuf->cbuf_store = CBUF_STORE_EMBEDDED;
+	} else if (cbuf->cbuf_store == CBUF_STORE_SHARED) {
+		/*
+		 * The data was moved to a shared data block; drop our
+		 * reference to it and restore the embedded backing store.
+		 */
+		cbuf_dblk_rele(cbuf->cbuf_dblk);
+		cbuf->cbuf_dblk = NULL;
+		cbuf->cbuf_data = (uint8_t *)(cbuf + 1);
+		cbuf->cbuf_store = CBUF_STORE_EMBEDDED;
+	}
+	VERIFY3U(cbuf->cbuf_store, ==, CBUF_STORE_EMBEDDED);
+
+	cbpc->cbpc_outstanding--;
+	list_insert_head(&cbpc->cbpc_free, cbuf);
+}
@@ -0,0 +1,154 @@
+#define	_GNU_SOURCE
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "libcbuf_impl.h"
+#include "libcbuf.h"
+
+/*
+ * Create an anonymous shared memory object of the given size.
+ */
+static int
+cbuf_ring_memfd(size_t size)
+{
+	int fd;
+
+#ifdef	MFD_CLOEXEC
+	if ((fd = memfd_create("libcbuf-ring", MFD_CLOEXEC)) < 0) {
+		return (-1);
+	}
+#else
+	/*
+	 * Without memfd_create(), use a POSIX shared memory object which is
+	 * unlinked as soon as it has been opened.
+	 */
+	static unsigned int seq;
+	char name[64];
+
+	(void) snprintf(name, sizeof (name), "/libcbuf-ring.%d.%u",
+	    (int)getpid(), __atomic_fetch_add(&seq, 1, __ATOMIC_RELAXED));
+	if ((fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600)) < 0) {
+		return (-1);
+	}
+	(void) shm_unlink(name);
+#endif
+
+	if (ftruncate(fd, (off_t)size) != 0) {
+		int e = errno;
+		(void) close(fd);
+		errno = e;
+		return (-1);
+	}
+
+	return (fd);
+}
+
+int
+cbuf_ring_alloc(cbuf_t **cbufp, size_t capacity)
+{
+	size_t pgsz = (size_t)sysconf(_SC_PAGESIZE);
+	size_t mapsz;
+	cbuf_t *cbuf;
+	void *base;
+	int fd;
+
+	*cbufp = NULL;
+
+	if (capacity == 0) {
+		errno = EINVAL;
+		return (-1);
+	}
+
+	/*
+	 * Round the capacity up to a whole number of pages, and make sure
+	 * that both copies of it will fit in the address space.
+	 */
+	if (cbuf_safe_add(&capacity, capacity, pgsz - 1) != 0) {
+		return (-1);
+	}
+	capacity -= capacity % pgsz;
+	if (cbuf_safe_mul(&mapsz, capacity, 2) != 0) {
+		return (-1);
+	}
+
+	if ((cbuf = calloc(1, sizeof (*cbuf))) == NULL) {
+		return (-1);
+	}
+
+	if ((fd = cbuf_ring_memfd(capacity)) < 0) {
+		free(cbuf);
+		return (-1);
+	}
+
+	/*
+	 * Reserve enough address space for two copies of the ring, then map
+	 * the shared memory object into each half.
+	 */
+	if ((base = mmap(NULL, mapsz, PROT_NONE, MAP_PRIVATE | MAP_ANON, -1,
+	    0)) == MAP_FAILED) {
+		goto fail;
+	}
+
+	if (mmap(base, capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+	    fd, 0) == MAP_FAILED ||
+	    mmap((uint8_t *)base + capacity, capacity, PROT_READ | PROT_WRITE,
+	    MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+		int e = errno;
+		(void) munmap(base, mapsz);
+		errno = e;
+		goto fail;
+	}
+	(void) close(fd);
+
+	cbuf->cbuf_ring_base = base;
+	cbuf->cbuf_data = base;
+	cbuf->cbuf_store = CBUF_STORE_RING;
+	cbuf->cbuf_capacity = capacity;
+	cbuf->cbuf_limit = cbuf->cbuf_capacity;
+	cbuf->cbuf_position = 0;
+	cbuf->cbuf_order = CBUF_ORDER_BIG_ENDIAN;
+	cbuf->cbuf_growth = CBUF_GROWTH_EXACT;
+	CBUF_STAT_ADD(cbs_allocs, 1);
+
+	*cbufp = cbuf;
+	return (0);
+
+fail:
+	{
+		int e = errno;
+		(void) close(fd);
+		free(cbuf);
+		errno = e;
+	}
+	return (-1);
+}
+
+/*
+ * Rather than moving the available bytes to the start of the buffer, move
+ * the start of the buffer forward to the position.  The start always stays
+ * within the first copy of the ring.
+ */
+void
+cbuf_ring_compact(cbuf_t *cbuf)
+{
+	VERIFY3U(cbuf->cbuf_store, ==, CBUF_STORE_RING);
+
+	size_t start = (size_t)(cbuf->cbuf_data - cbuf->cbuf_ring_base);
+	VERIFY3U(start, <, cbuf->cbuf_capacity);
+
+	start = (start + cbuf->cbuf_position) % cbuf->cbuf_capacity;
+	cbuf->cbuf_data = cbuf->cbuf_ring_base + start;
+
+	VERIFY3U(cbuf->cbuf_limit, >=, cbuf->cbuf_position);
+	cbuf->cbuf_limit -= cbuf->cbuf_position;
+	cbuf->cbuf_position = 0;
+}
+
+void
+cbuf_ring_free(cbuf_t *cbuf)
+{
+	VERIFY3U(cbuf->cbuf_store, ==, CBUF_STORE_RING);
+
+	VERIFY0(munmap(cbuf->cbuf_ring_base, 2 * cbuf->cbuf_capacity));
+}
@@ -0,0 +1,301 @@
+#define	_GNU_SOURCE
+#include <fcntl.h>
+#include <sys/sendfile.h>
+
+#include "libcbuf_impl.h"
+#include "libcbuf.h"
+
+/*
+ * Use sendfile(2) to copy data between file descriptors within the kernel.
+ */
+int
+cbuf_sys_sendfile(int out_fd, int in_fd, off_t *offset, size_t want,
+    size_t *actual)
+{
+	if (want == 0) {
+		errno = EINVAL;
+		return (-1);
+	}
+
+	ssize_t wsz = sendfile(out_fd, in_fd, offset, want);
+	CBUF_STAT_SYS(CBUF_STAT_SYS_SENDFILE, want, wsz);
+	if (wsz < 0) {
+		return (-1);
+	}
+
+	if (actual != NULL) {
+		*actual = (size_t)wsz;
+	}
+	return (0);
+}
+
+/*
+ * Use vmsplice(2) to consume data from the buffer.
+ */
+int
+cbuf_sys_vmsplice(cbuf_t *cbuf, int pipe_fd, size_t want, size_t *actual)
+{
+	if (cbuf_sys_size_check(cbuf, &want) != 0) {
+		return (-1);
+	}
+
+	size_t pos = cbuf_position(cbuf);
+	struct iovec iov = {
+		.iov_base = &cbuf->cbuf_data[pos],
+		.iov_len = want,
+	};
+	ssize_t wsz = vmsplice(pipe_fd, &iov, 1, 0);
+	CBUF_STAT_SYS(CBUF_STAT_SYS_VMSPLICE, want, wsz);
+	if (wsz < 0) {
+		return (-1);
+	}
+	VERIFY0(cbuf_position_set(cbuf, pos + wsz));
+
+	if (actual != NULL) {
+		*actual = (size_t)wsz;
+	}
+	return (0);
+}
+
+int
+cbuf_splice_alloc(cbuf_splice_t **spp)
+{
+	cbuf_splice_t *sp;
+	int sz;
+
+	*spp = NULL;
+
+	if ((sp = calloc(1, sizeof (*sp))) == NULL) {
+		return (-1);
+	}
+
+	if (cbufq_alloc(&sp->cbsp_held) != 0) {
+		free(sp);
+		return (-1);
+	}
+
+	if (pipe2(sp->cbsp_pipe, O_CLOEXEC | O_NONBLOCK) != 0) {
+		int e = errno;
+		cbufq_free(sp->cbsp_held);
+		free(sp);
+		errno = e;
+		return (-1);
+	}
+
+	if ((sz = fcntl(sp->cbsp_pipe[0], F_GETPIPE_SZ)) < 0) {
+		int e = errno;
+		cbuf_splice_free(sp);
+		errno = e;
+		return (-1);
+	}
+	sp->cbsp_size = (size_t)sz;
+
+	*spp = sp;
+	return (0);
+}
+
+void
+cbuf_splice_free(cbuf_splice_t *sp)
+{
+	if (sp == NULL) {
+		return;
+	}
+
+	VERIFY0(close(sp->cbsp_pipe[0]));
+	VERIFY0(close(sp->cbsp_pipe[1]));
+	cbufq_free(sp->cbsp_held);
+	free(sp);
+}
+
+size_t
+cbuf_splice_pending(cbuf_splice_t *sp)
+{
+	return (sp->cbsp_pending);
+}
+
+/*
+ * Move up to "want" pending bytes from the pipe to "out_fd".  The call is
+ * counted against the wrapper "which".
+ */
+static int
+cbuf_splice_drain(cbuf_splice_t *sp, int out_fd, size_t want, size_t *moved,
+    cbuf_stat_sys_t which)
+{
+	if (want > sp->cbsp_pending) {
+		want = sp->cbsp_pending;
+	}
+
+	ssize_t wsz = splice(sp->cbsp_pipe[0], NULL, out_fd, NULL, want,
+	    SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+	CBUF_STAT_SYS(which, want, wsz);
+	if (wsz < 0) {
+		return (-1);
+	}
+
+	VERIFY3U(sp->cbsp_pending, >=, (size_t)wsz);
+	sp->cbsp_pending -= (size_t)wsz;
+	*moved = (size_t)wsz;
+	return (0);
+}
+
+/*
+ * Use splice(2) to move data from "in_fd" to "out_fd" through the pipe.
+ */
+int
+cbuf_sys_splice(cbuf_splice_t *sp, int in_fd, int out_fd, size_t want,
+    size_t *actual)
+{
+	size_t moved = 0;
+
+	if (want == 0) {
+		errno = EINVAL;
+		return (-1);
+	}
+
+	if (sp->cbsp_cbufq != NULL) {
+		/*
+		 * The pipe holds data from a queue, which must be written
+		 * out with cbufq_sys_vmsplice() first.
+		 */
+		errno = EBUSY;
+		return (-1);
+	}
+
+	if (sp->cbsp_pending == 0) {
+		size_t sz = (want < sp->cbsp_size) ? want : sp->cbsp_size;
+		ssize_t rsz;
+
+		rsz = splice(in_fd, NULL, sp->cbsp_pipe[1], NULL, sz,
+		    SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		CBUF_STAT_SYS(CBUF_STAT_SYS_SPLICE, sz, rsz);
+		if (rsz < 0) {
+			return (-1);
+		}
+		sp->cbsp_pending = (size_t)rsz;
+	}
+
+	if (sp->cbsp_pending > 0 && cbuf_splice_drain(sp, out_fd, want,
+	    &moved, CBUF_STAT_SYS_SPLICE) != 0) {
+		return (-1);
+	}
+
+	if (actual != NULL) {
+		*actual = moved;
+	}
+	return (0);
+}
+
+/*
+ * Place bytes from the head of the queue in the empty pipe.  Each range is
+ * first held (see cbuf_hold()) on the held queue, so that the memory the pipe
+ * refers to stays in place after the bytes are consumed from the queue.
+ */
+static int
+cbuf_splice_fill(cbuf_splice_t *sp, cbufq_t *cbufq)
+{
+	struct iovec iov[IOV_MAX];
+	size_t held = cbufq_available(sp->cbsp_held);
+	size_t total = 0;
+	int niov = 0;
+
+	VERIFY3U(sp->cbsp_pending, ==, 0);
+
+	for (cbuf_t *cbuf = list_head(&cbufq->cbufq_bufs); cbuf != NULL &&
+	    niov < IOV_MAX && total < sp->cbsp_size;
+	    cbuf = list_next(&cbufq->cbufq_bufs, cbuf)) {
+		size_t avail = cbuf_available(cbuf);
+		cbuf_t *hold;
+
+		if (avail == 0) {
+			continue;
+		}
+		if (avail > sp->cbsp_size - total) {
+			avail = sp->cbsp_size - total;
+		}
+
+		if (cbuf_hold(cbuf, &hold, cbuf_position(cbuf),
+		    avail) != 0) {
+			int e = errno;
+			cbufq_truncate(sp->cbsp_held, held);
+			errno = e;
+			return (-1);
+		}
+		cbufq_enq(sp->cbsp_held, hold);
+
+		iov[niov].iov_base = hold->cbuf_data;
+		iov[niov].iov_len = avail;
+		niov++;
+		total += avail;
+	}
+
+	if (niov == 0) {
+		errno = ENODATA;
+		return (-1);
+	}
+
+	ssize_t wsz = vmsplice(sp->cbsp_pipe[1], iov, niov, SPLICE_F_NONBLOCK);
+	CBUF_STAT_SYS(CBUF_STAT_SYS_QVMSPLICE, total, wsz);
+	if (wsz < 0) {
+		int e = errno;
+		cbufq_truncate(sp->cbsp_held, held);
+		errno = e;
+		return (-1);
+	}
+
+	/*
+	 * The pipe may not have had room for everything.  Drop the holds on
+	 * any bytes that it did not take.
+	 */
+	cbufq_truncate(sp->cbsp_held, held + (size_t)wsz);
+	sp->cbsp_pending = (size_t)wsz;
+	sp->cbsp_cbufq = cbufq;
+	return (0);
+}
+
+/*
+ * Use vmsplice(2) and splice(2) to consume data from the queue.  The bytes in
+ * the pipe still belong to the buffers at the head of the queue, so they are
+ * only consumed once they have been written to "out_fd".
+ */
+int
+cbufq_sys_vmsplice(cbufq_t *cbufq, cbuf_splice_t *sp, int out_fd,
+    size_t *actual)
+{
+	size_t moved;
+
+	if (sp->cbsp_pending > 0 && sp->cbsp_cbufq != cbufq) {
+		errno = EBUSY;
+		return (-1);
+	}
+
+	if (sp->cbsp_pending == 0 && cbuf_splice_fill(sp, cbufq) != 0) {
+		return (-1);
+	}
+
+	if (cbuf_splice_drain(sp, out_fd, sp->cbsp_pending, &moved,
+	    CBUF_STAT_SYS_QVMSPLICE) != 0) {
+		return (-1);
+	}
+	cbufq_consume(cbufq, moved);
+	if (sp->cbsp_pending == 0) {
+		sp->cbsp_cbufq = NULL;
+	}
+
+	if (actual != NULL) {
+		*actual = moved;
+	}
+	return (0);
+}
+
+void
+cbuf_splice_release(cbuf_splice_t *sp)
+{
+	size_t held = cbufq_available(sp->cbsp_held);
+
+	/*
+	 * The pending bytes are the last bytes on the held queue, and are still
+	 * in the pipe.
+	 */
+	VERIFY3U(held, >=, sp->cbsp_pending);
+	cbufq_consume(sp->cbsp_held, held - sp->cbsp_pending);
+}
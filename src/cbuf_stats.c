@@ -0,0 +1,160 @@
+#include <pthread.h>
+
+#include "libcbuf_impl.h"
+#include "libcbuf.h"
+
+static const char *cbuf_stats_sys_names[CBUF_STAT_SYS_NTYPES] = {
+	[CBUF_STAT_SYS_READ] = "read",
+	[CBUF_STAT_SYS_WRITE] = "write",
+	[CBUF_STAT_SYS_SEND] = "send",
+	[CBUF_STAT_SYS_SENDTO] = "sendto",
+	[CBUF_STAT_SYS_RECVFROM] = "recvfrom",
+	[CBUF_STAT_SYS_READV] = "readv",
+	[CBUF_STAT_SYS_WRITEV] = "writev",
+	[CBUF_STAT_SYS_SENDMSG] = "sendmsg",
+	[CBUF_STAT_SYS_SENDFILE] = "sendfile",
+	[CBUF_STAT_SYS_VMSPLICE] = "vmsplice",
+	[CBUF_STAT_SYS_SPLICE] = "splice",
+	[CBUF_STAT_SYS_QVMSPLICE] = "qvmsplice",
+	[CBUF_STAT_SYS_RECVMMSG] = "recvmmsg",
+	[CBUF_STAT_SYS_SENDMMSG] = "sendmmsg",
+	[CBUF_STAT_SYS_ZC_SEND] = "zc_send",
+};
+
+#ifdef	CBUF_STATS
+/*
+ * The counters of each thread that has used the library are kept on a list,
+ * so that they can be added together by cbuf_stats_snapshot().  When a thread
+ * exits, its counters are folded into "cbuf_stats_exited" and freed.
+ */
+typedef struct cbuf_stats_thread {
+	cbuf_stats_t cbst_stats;
+	list_node_t cbst_link;
+} cbuf_stats_thread_t;
+
+__thread cbuf_stats_t *cbuf_stats_tls;
+
+static pthread_mutex_t cbuf_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t cbuf_stats_once = PTHREAD_ONCE_INIT;
+static pthread_key_t cbuf_stats_key;
+static list_t cbuf_stats_threads;
+static cbuf_stats_t cbuf_stats_exited;
+
+/*
+ * Add each counter in "src" to "dst".  The structure holds nothing but
+ * counters, so it is treated as an array of them.
+ */
+static void
+cbuf_stats_add(cbuf_stats_t *dst, const cbuf_stats_t *src)
+{
+	uint64_t *d = (uint64_t *)dst;
+	const uint64_t *s = (const uint64_t *)src;
+
+	CTASSERT(sizeof (cbuf_stats_t) % sizeof (uint64_t) == 0);
+
+	for (size_t i = 0; i < sizeof (cbuf_stats_t) / sizeof (uint64_t);
+	    i++) {
+		d[i] += __atomic_load_n(&s[i], __ATOMIC_RELAXED);
+	}
+}
+
+static void
+cbuf_stats_detach(void *arg)
+{
+	cbuf_stats_thread_t *cbst = arg;
+
+	VERIFY0(pthread_mutex_lock(&cbuf_stats_lock));
+	cbuf_stats_add(&cbuf_stats_exited, &cbst->cbst_stats);
+	list_remove(&cbuf_stats_threads, cbst);
+	VERIFY0(pthread_mutex_unlock(&cbuf_stats_lock));
+
+	free(cbst);
+}
+
+static void
+cbuf_stats_init(void)
+{
+	list_create(&cbuf_stats_threads, sizeof (cbuf_stats_thread_t),
+	    offsetof(cbuf_stats_thread_t, cbst_link));
+	VERIFY0(pthread_key_create(&cbuf_stats_key, cbuf_stats_detach));
+}
+
+/*
+ * Called the first time a thread counts anything.  If the counters cannot be
+ * allocated, the thread's activity simply goes uncounted.
+ */
+cbuf_stats_t *
+cbuf_stats_attach(void)
+{
+	cbuf_stats_thread_t *cbst;
+	int e = errno;
+
+	VERIFY0(pthread_once(&cbuf_stats_once, cbuf_stats_init));
+
+	/*
+	 * We may be counting a failed system call, so errno must survive.
+	 */
+	if ((cbst = calloc(1, sizeof (*cbst))) == NULL) {
+		errno = e;
+		return (NULL);
+	}
+	if (pthread_setspecific(cbuf_stats_key, cbst) != 0) {
+		free(cbst);
+		errno = e;
+		return (NULL);
+	}
+
+	VERIFY0(pthread_mutex_lock(&cbuf_stats_lock));
+	list_insert_tail(&cbuf_stats_threads, cbst);
+	VERIFY0(pthread_mutex_unlock(&cbuf_stats_lock));
+
+	cbuf_stats_tls = &cbst->cbst_stats;
+	errno = e;
+	return (cbuf_stats_tls);
+}
+#endif
+
+int
+cbuf_stats_snapshot(cbuf_stats_t *stats)
+{
+	bzero(stats, sizeof (*stats));
+
+#ifdef	CBUF_STATS
+	VERIFY0(pthread_once(&cbuf_stats_once, cbuf_stats_init));
+
+	VERIFY0(pthread_mutex_lock(&cbuf_stats_lock));
+	cbuf_stats_add(stats, &cbuf_stats_exited);
+	for (cbuf_stats_thread_t *cbst = list_head(&cbuf_stats_threads);
+	    cbst != NULL; cbst = list_next(&cbuf_stats_threads, cbst)) {
+		cbuf_stats_add(stats, &cbst->cbst_stats);
+	}
+	VERIFY0(pthread_mutex_unlock(&cbuf_stats_lock));
+
+	return (0);
+#else
+	errno = ENOTSUP;
+	return (-1);
+#endif
+}
+
+void
+cbuf_stats_dump(const cbuf_stats_t *stats, FILE *fp)
+{
+	fprintf(fp, "cbuf_stats[%p]: allocs %8" PRIu64 " frees %8" PRIu64
+	    "\n", stats, stats->cbs_allocs, stats->cbs_frees);
+	fprintf(fp, "    reallocs %8" PRIu64 " bytes %12" PRIu64 "\n",
+	    stats->cbs_reallocs, stats->cbs_realloc_bytes);
+	fprintf(fp, "    compact bytes %12" PRIu64 "\n",
+	    stats->cbs_compact_bytes);
+	fprintf(fp, "    pullup bytes  %12" PRIu64 "\n",
+	    stats->cbs_pullup_bytes);
+
+	for (unsigned int i = 0; i < CBUF_STAT_SYS_NTYPES; i++) {
+		const cbuf_stats_sys_t *cbss = &stats->cbs_sys[i];
+
+		fprintf(fp, "    %-9s calls %8" PRIu64 " errors %8" PRIu64
+		    " short %8" PRIu64 "\n", cbuf_stats_sys_names[i],
+		    cbss->cbss_calls, cbss->cbss_errors, cbss->cbss_short);
+	}
+	fprintf(fp, "\n");
+}
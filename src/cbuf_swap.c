@@ -0,0 +1,162 @@
+#include "libcbuf_impl.h"
+#include "libcbuf.h"
+
+/*
+ * Byte-swapping copy kernels for the array get and put functions.  On x86 we
+ * select SSSE3 or AVX2 shuffle kernels at runtime based on the features of
+ * the CPU; elsewhere, or on older CPUs, a portable loop is used.
+ */
+
+#if defined(__x86_64__) || defined(__i386__)
+#define	CBUF_SWAP_X86
+#include <immintrin.h>
+#endif
+
+typedef void cbuf_swap_func_t(void *, const void *, size_t);
+
+#define	CBUF_SWAP_PORTABLE(name, type, bswap)				\
+	static void							\
+	name(void *dst, const void *src, size_t count)			\
+	{								\
+		uint8_t *d = dst;					\
+		const uint8_t *s = src;					\
+									\
+		for (size_t i = 0; i < count; i++) {			\
+			type val;					\
+									\
+			memcpy(&val, s, sizeof (val));			\
+			val = bswap(val);				\
+			memcpy(d, &val, sizeof (val));			\
+									\
+			s += sizeof (val);				\
+			d += sizeof (val);				\
+		}							\
+	}
+
+CBUF_SWAP_PORTABLE(cbuf_swap16_portable, uint16_t, __builtin_bswap16)
+CBUF_SWAP_PORTABLE(cbuf_swap32_portable, uint32_t, __builtin_bswap32)
+CBUF_SWAP_PORTABLE(cbuf_swap64_portable, uint64_t, __builtin_bswap64)
+
+#ifdef	CBUF_SWAP_X86
+/*
+ * Shuffle masks which reverse the bytes of each 2, 4 or 8 byte element within
+ * a 16 byte lane.  Note that _mm_set_epi8() takes its arguments from the most
+ * significant byte to the least, so the masks are listed in reverse.
+ */
+#define	CBUF_MASK16	14, 15, 12, 13, 10, 11, 8, 9, 6, 7, 4, 5, 2, 3, 0, 1
+#define	CBUF_MASK32	12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3
+#define	CBUF_MASK64	8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7
+
+#define	CBUF_SWAP_SSSE3(name, mask, width, tail)			\
+	__attribute__((target("ssse3")))				\
+	static void							\
+	name(void *dst, const void *src, size_t count)			\
+	{								\
+		const __m128i m = _mm_set_epi8(mask);			\
+		uint8_t *d = dst;					\
+		const uint8_t *s = src;					\
+		size_t per = 16 / (width);				\
+		size_t i = 0;						\
+									\
+		for (; i + per <= count; i += per) {			\
+			__m128i v = _mm_loadu_si128((const __m128i *)s); \
+			_mm_storeu_si128((__m128i *)d,			\
+			    _mm_shuffle_epi8(v, m));			\
+			s += 16;					\
+			d += 16;					\
+		}							\
+		tail(d, s, count - i);					\
+	}
+
+#define	CBUF_SWAP_AVX2(name, mask, width, tail)				\
+	__attribute__((target("avx2")))					\
+	static void							\
+	name(void *dst, const void *src, size_t count)			\
+	{								\
+		const __m256i m = _mm256_set_epi8(mask, mask);		\
+		uint8_t *d = dst;					\
+		const uint8_t *s = src;					\
+		size_t per = 32 / (width);				\
+		size_t i = 0;						\
+									\
+		for (; i + per <= count; i += per) {			\
+			__m256i v = _mm256_loadu_si256(			\
+			    (const __m256i *)s);			\
+			_mm256_storeu_si256((__m256i *)d,		\
+			    _mm256_shuffle_epi8(v, m));			\
+			s += 32;					\
+			d += 32;					\
+		}							\
+		tail(d, s, count - i);					\
+	}
+
+CBUF_SWAP_SSSE3(cbuf_swap16_ssse3, CBUF_MASK16, 2, cbuf_swap16_portable)
+CBUF_SWAP_SSSE3(cbuf_swap32_ssse3, CBUF_MASK32, 4, cbuf_swap32_portable)
+CBUF_SWAP_SSSE3(cbuf_swap64_ssse3, CBUF_MASK64, 8, cbuf_swap64_portable)
+
+CBUF_SWAP_AVX2(cbuf_swap16_avx2, CBUF_MASK16, 2, cbuf_swap16_ssse3)
+CBUF_SWAP_AVX2(cbuf_swap32_avx2, CBUF_MASK32, 4, cbuf_swap32_ssse3)
+CBUF_SWAP_AVX2(cbuf_swap64_avx2, CBUF_MASK64, 8, cbuf_swap64_ssse3)
+#endif	/* CBUF_SWAP_X86 */
+
+static cbuf_swap_func_t *cbuf_swap16_impl;
+static cbuf_swap_func_t *cbuf_swap32_impl;
+static cbuf_swap_func_t *cbuf_swap64_impl;
+
+/*
+ * Choose the kernels to use on this CPU.  Racing threads will all make the
+ * same choice, so no locking is required.
+ */
+static void
+cbuf_swap_init(void)
+{
+	cbuf_swap_func_t *f16 = cbuf_swap16_portable;
+	cbuf_swap_func_t *f32 = cbuf_swap32_portable;
+	cbuf_swap_func_t *f64 = cbuf_swap64_portable;
+
+#ifdef	CBUF_SWAP_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		f16 = cbuf_swap16_avx2;
+		f32 = cbuf_swap32_avx2;
+		f64 = cbuf_swap64_avx2;
+	} else if (__builtin_cpu_supports("ssse3")) {
+		f16 = cbuf_swap16_ssse3;
+		f32 = cbuf_swap32_ssse3;
+		f64 = cbuf_swap64_ssse3;
+	}
+#endif
+
+	__atomic_store_n(&cbuf_swap32_impl, f32, __ATOMIC_RELAXED);
+	__atomic_store_n(&cbuf_swap64_impl, f64, __ATOMIC_RELAXED);
+	__atomic_store_n(&cbuf_swap16_impl, f16, __ATOMIC_RELEASE);
+}
+
+static void
+cbuf_swap_ensure(void)
+{
+	if (__atomic_load_n(&cbuf_swap16_impl, __ATOMIC_ACQUIRE) == NULL) {
+		cbuf_swap_init();
+	}
+}
+
+void
+cbuf_swap16(void *dst, const void *src, size_t count)
+{
+	cbuf_swap_ensure();
+	cbuf_swap16_impl(dst, src, count);
+}
+
+void
+cbuf_swap32(void *dst, const void *src, size_t count)
+{
+	cbuf_swap_ensure();
+	cbuf_swap32_impl(dst, src, count);
+}
+
+void
+cbuf_swap64(void *dst, const void *src, size_t count)
+{
+	cbuf_swap_ensure();
+	cbuf_swap64_impl(dst, src, count);
+}
@@ -0,0 +1,541 @@
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "libcbuf_impl.h"
+#include "libcbuf.h"
+
+/*
+ * There is no libc wrapper for the io_uring system calls.
+ */
+static int
+cbuf_uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+	return ((int)syscall(__NR_io_uring_setup, entries, p));
+}
+
+static int
+cbuf_uring_enter(int fd, unsigned int to_submit, unsigned int min_complete,
+    unsigned int flags)
+{
+	return ((int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+	    flags, NULL, 0));
+}
+
+int
+cbuf_uring_alloc(cbuf_uring_t **ringp, unsigned int entries)
+{
+	struct io_uring_params p;
+	cbuf_uring_t *ring;
+	int e;
+
+	*ringp = NULL;
+
+	if (entries == 0) {
+		errno = EINVAL;
+		return (-1);
+	}
+
+	if ((ring = calloc(1, sizeof (*ring))) == NULL) {
+		return (-1);
+	}
+	ring->cbu_sq_map = MAP_FAILED;
+	ring->cbu_cq_map = MAP_FAILED;
+	ring->cbu_sqes = MAP_FAILED;
+
+	bzero(&p, sizeof (p));
+	if ((ring->cbu_fd = cbuf_uring_setup(entries, &p)) < 0) {
+		free(ring);
+		return (-1);
+	}
+
+	/*
+	 * Map the submission and completion rings, which share a single
+	 * mapping on all but the oldest kernels, and the submission queue
+	 * entries.
+	 */
+	ring->cbu_sq_mapsz = p.sq_off.array + p.sq_entries * sizeof (uint32_t);
+	ring->cbu_cq_mapsz = p.cq_off.cqes + p.cq_entries *
+	    sizeof (struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring->cbu_cq_mapsz > ring->cbu_sq_mapsz) {
+			ring->cbu_sq_mapsz = ring->cbu_cq_mapsz;
+		}
+		ring->cbu_cq_mapsz = ring->cbu_sq_mapsz;
+	}
+
+	if ((ring->cbu_sq_map = mmap(NULL, ring->cbu_sq_mapsz,
+	    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->cbu_fd,
+	    IORING_OFF_SQ_RING)) == MAP_FAILED) {
+		goto fail;
+	}
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		ring->cbu_cq_map = ring->cbu_sq_map;
+	} else if ((ring->cbu_cq_map = mmap(NULL, ring->cbu_cq_mapsz,
+	    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->cbu_fd,
+	    IORING_OFF_CQ_RING)) == MAP_FAILED) {
+		goto fail;
+	}
+	if ((ring->cbu_sqes = mmap(NULL, p.sq_entries *
+	    sizeof (struct io_uring_sqe), PROT_READ | PROT_WRITE,
+	    MAP_SHARED | MAP_POPULATE, ring->cbu_fd,
+	    IORING_OFF_SQES)) == MAP_FAILED) {
+		goto fail;
+	}
+
+	uint8_t *sq = ring->cbu_sq_map;
+	ring->cbu_sq_head = (uint32_t *)(sq + p.sq_off.head);
+	ring->cbu_sq_tail = (uint32_t *)(sq + p.sq_off.tail);
+	ring->cbu_sq_array = (uint32_t *)(sq + p.sq_off.array);
+	ring->cbu_sq_mask = *(uint32_t *)(sq + p.sq_off.ring_mask);
+	ring->cbu_sq_entries = p.sq_entries;
+
+	uint8_t *cq = ring->cbu_cq_map;
+	ring->cbu_cq_head = (uint32_t *)(cq + p.cq_off.head);
+	ring->cbu_cq_tail = (uint32_t *)(cq + p.cq_off.tail);
+	ring->cbu_cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+	ring->cbu_cq_mask = *(uint32_t *)(cq + p.cq_off.ring_mask);
+
+	/*
+	 * Allow as many operations in flight as there are completion queue
+	 * entries, so that the completion queue cannot overflow.
+	 */
+	if ((ring->cbu_ops = calloc(p.cq_entries,
+	    sizeof (cbuf_uring_op_t))) == NULL) {
+		goto fail;
+	}
+	for (uint32_t i = 0; i < p.cq_entries; i++) {
+		ring->cbu_ops[i].cbuo_next = i + 1;
+	}
+	ring->cbu_nops = p.cq_entries;
+	ring->cbu_free_op = 0;
+
+	*ringp = ring;
+	return (0);
+
+fail:
+	e = errno;
+	cbuf_uring_free(ring);
+	errno = e;
+	return (-1);
+}
+
+void
+cbuf_uring_free(cbuf_uring_t *ring)
+{
+	if (ring == NULL) {
+		return;
+	}
+
+	/*
+	 * Closing the ring cancels anything still in flight.
+	 */
+	VERIFY0(close(ring->cbu_fd));
+
+	if (ring->cbu_sqes != MAP_FAILED) {
+		VERIFY0(munmap(ring->cbu_sqes, ring->cbu_sq_entries *
+		    sizeof (struct io_uring_sqe)));
+	}
+	if (ring->cbu_cq_map != MAP_FAILED &&
+	    ring->cbu_cq_map != ring->cbu_sq_map) {
+		VERIFY0(munmap(ring->cbu_cq_map, ring->cbu_cq_mapsz));
+	}
+	if (ring->cbu_sq_map != MAP_FAILED) {
+		VERIFY0(munmap(ring->cbu_sq_map, ring->cbu_sq_mapsz));
+	}
+
+	for (uint32_t i = 0; i < ring->cbu_nops; i++) {
+		free(ring->cbu_ops[i].cbuo_iov);
+	}
+	free(ring->cbu_ops);
+	free(ring->cbu_regs);
+	free(ring);
+}
+
+static int
+cbuf_uring_reg_cmp(const void *a, const void *b)
+{
+	const cbuf_uring_reg_t *ra = a;
+	const cbuf_uring_reg_t *rb = b;
+
+	if (ra->cbur_base < rb->cbur_base) {
+		return (-1);
+	}
+	return (ra->cbur_base > rb->cbur_base);
+}
+
+int
+cbuf_uring_register(cbuf_uring_t *ring, cbuf_t **cbufs, unsigned int ncbufs)
+{
+	struct iovec *iov;
+	int ret = -1;
+
+	if (ncbufs == 0) {
+		errno = EINVAL;
+		return (-1);
+	}
+	if (ring->cbu_nregs != 0) {
+		errno = EBUSY;
+		return (-1);
+	}
+
+	if ((iov = calloc(ncbufs, sizeof (*iov))) == NULL) {
+		return (-1);
+	}
+	if ((ring->cbu_regs = calloc(ncbufs,
+	    sizeof (cbuf_uring_reg_t))) == NULL) {
+		goto out;
+	}
+
+	for (unsigned int i = 0; i < ncbufs; i++) {
+		iov[i].iov_base = cbufs[i]->cbuf_data;
+		iov[i].iov_len = cbufs[i]->cbuf_capacity;
+
+		ring->cbu_regs[i].cbur_base = cbufs[i]->cbuf_data;
+		ring->cbu_regs[i].cbur_len = cbufs[i]->cbuf_capacity;
+		ring->cbu_regs[i].cbur_index = i;
+	}
+
+	if (syscall(__NR_io_uring_register, ring->cbu_fd,
+	    IORING_REGISTER_BUFFERS, iov, ncbufs) != 0) {
+		int e = errno;
+		free(ring->cbu_regs);
+		ring->cbu_regs = NULL;
+		errno = e;
+		goto out;
+	}
+
+	/*
+	 * Sort the registered ranges by address, so that the range holding a
+	 * buffer can be found with a binary search at submission time.
+	 */
+	qsort(ring->cbu_regs, ncbufs, sizeof (cbuf_uring_reg_t),
+	    cbuf_uring_reg_cmp);
+	ring->cbu_nregs = ncbufs;
+	ret = 0;
+
+out:
+	free(iov);
+	return (ret);
+}
+
+/*
+ * Find the registered range, if any, that holds the "len" bytes at "addr".
+ */
+static cbuf_uring_reg_t *
+cbuf_uring_reg_find(cbuf_uring_t *ring, const uint8_t *addr, size_t len)
+{
+	unsigned int lo = 0;
+	unsigned int hi = ring->cbu_nregs;
+
+	while (lo < hi) {
+		unsigned int mid = lo + (hi - lo) / 2;
+		cbuf_uring_reg_t *reg = &ring->cbu_regs[mid];
+
+		if (addr < reg->cbur_base) {
+			hi = mid;
+		} else if (addr >= reg->cbur_base + reg->cbur_len) {
+			lo = mid + 1;
+		} else {
+			if ((size_t)(addr - reg->cbur_base) + len <=
+			    reg->cbur_len) {
+				return (reg);
+			}
+			return (NULL);
+		}
+	}
+
+	return (NULL);
+}
+
+int
+cbuf_uring_submit(cbuf_uring_t *ring, unsigned int *submitted)
+{
+	int n = 0;
+
+	if (ring->cbu_unsubmitted > 0 && (n = cbuf_uring_enter(ring->cbu_fd,
+	    ring->cbu_unsubmitted, 0, 0)) < 0) {
+		return (-1);
+	}
+	VERIFY3U((unsigned int)n, <=, ring->cbu_unsubmitted);
+	ring->cbu_unsubmitted -= (unsigned int)n;
+
+	if (submitted != NULL) {
+		*submitted = (unsigned int)n;
+	}
+	return (0);
+}
+
+/*
+ * Allocate an operation slot and a submission queue entry for it.  If the
+ * submission queue is full, the entries in it are submitted first.
+ */
+static struct io_uring_sqe *
+cbuf_uring_sqe(cbuf_uring_t *ring, cbuf_uring_op_t **opp)
+{
+	uint32_t tail = *ring->cbu_sq_tail;
+
+	if (ring->cbu_free_op == ring->cbu_nops) {
+		/*
+		 * Completions must be reaped before more operations can be
+		 * started.
+		 */
+		errno = EAGAIN;
+		return (NULL);
+	}
+
+	if (tail - __atomic_load_n(ring->cbu_sq_head, __ATOMIC_ACQUIRE) >=
+	    ring->cbu_sq_entries) {
+		if (cbuf_uring_submit(ring, NULL) != 0) {
+			return (NULL);
+		}
+		if (tail - __atomic_load_n(ring->cbu_sq_head,
+		    __ATOMIC_ACQUIRE) >= ring->cbu_sq_entries) {
+			errno = EAGAIN;
+			return (NULL);
+		}
+	}
+
+	uint32_t idx = ring->cbu_free_op;
+	cbuf_uring_op_t *op = &ring->cbu_ops[idx];
+	ring->cbu_free_op = op->cbuo_next;
+
+	struct io_uring_sqe *sqe = &ring->cbu_sqes[tail & ring->cbu_sq_mask];
+	bzero(sqe, sizeof (*sqe));
+	sqe->user_data = idx;
+
+	*opp = op;
+	return (sqe);
+}
+
+/*
+ * Make a submission queue entry filled out by the caller visible to the
+ * kernel.  It is not submitted until cbuf_uring_submit() or
+ * cbuf_uring_reap() is called.
+ */
+static void
+cbuf_uring_sqe_push(cbuf_uring_t *ring)
+{
+	uint32_t tail = *ring->cbu_sq_tail;
+
+	ring->cbu_sq_array[tail & ring->cbu_sq_mask] = tail & ring->cbu_sq_mask;
+	__atomic_store_n(ring->cbu_sq_tail, tail + 1, __ATOMIC_RELEASE);
+	ring->cbu_unsubmitted++;
+}
+
+static int
+cbuf_uring_submit_common(cbuf_uring_t *ring, cbuf_t *cbuf, int fd,
+    size_t want, int flags, void *arg, uint8_t opcode)
+{
+	cbuf_uring_op_t *op;
+	struct io_uring_sqe *sqe;
+
+	if (cbuf_sys_size_check(cbuf, &want) != 0) {
+		return (-1);
+	}
+	if (want > UINT32_MAX) {
+		want = UINT32_MAX;
+	}
+
+	if ((sqe = cbuf_uring_sqe(ring, &op)) == NULL) {
+		return (-1);
+	}
+
+	uint8_t *addr = &cbuf->cbuf_data[cbuf->cbuf_position];
+	cbuf_uring_reg_t *reg;
+
+	sqe->opcode = opcode;
+	sqe->fd = fd;
+	sqe->addr = (uintptr_t)addr;
+	sqe->len = (uint32_t)want;
+
+	switch (opcode) {
+	case IORING_OP_READ:
+	case IORING_OP_WRITE:
+		/*
+		 * Use the current file offset, as read(2) and write(2) do.
+		 * If the bytes lie within a registered buffer, the kernel
+		 * need not map the memory for each operation.
+		 */
+		sqe->off = (uint64_t)-1;
+		if ((reg = cbuf_uring_reg_find(ring, addr, want)) != NULL) {
+			sqe->opcode = (opcode == IORING_OP_READ) ?
+			    IORING_OP_READ_FIXED : IORING_OP_WRITE_FIXED;
+			sqe->buf_index = reg->cbur_index;
+		}
+		break;
+
+	case IORING_OP_RECV:
+	case IORING_OP_SEND:
+		sqe->msg_flags = (uint32_t)flags;
+		break;
+
+	default:
+		abort();
+		break;
+	}
+
+	op->cbuo_cbuf = cbuf;
+	op->cbuo_cbufq = NULL;
+	op->cbuo_position = cbuf->cbuf_position;
+	op->cbuo_arg = arg;
+	cbuf_uring_sqe_push(ring);
+
+	return (0);
+}
+
+int
+cbuf_uring_submit_read(cbuf_uring_t *ring, cbuf_t *cbuf, int fd, size_t want,
+    void *arg)
+{
+	return (cbuf_uring_submit_common(ring, cbuf, fd, want, 0, arg,
+	    IORING_OP_READ));
+}
+
+int
+cbuf_uring_submit_write(cbuf_uring_t *ring, cbuf_t *cbuf, int fd,
+    size_t want, void *arg)
+{
+	return (cbuf_uring_submit_common(ring, cbuf, fd, want, 0, arg,
+	    IORING_OP_WRITE));
+}
+
+int
+cbuf_uring_submit_recv(cbuf_uring_t *ring, cbuf_t *cbuf, int fd, size_t want,
+    int flags, void *arg)
+{
+	return (cbuf_uring_submit_common(ring, cbuf, fd, want, flags, arg,
+	    IORING_OP_RECV));
+}
+
+int
+cbuf_uring_submit_send(cbuf_uring_t *ring, cbuf_t *cbuf, int fd, size_t want,
+    int flags, void *arg)
+{
+	return (cbuf_uring_submit_common(ring, cbuf, fd, want, flags, arg,
+	    IORING_OP_SEND));
+}
+
+int
+cbufq_uring_submit_writev(cbuf_uring_t *ring, cbufq_t *cbufq, int fd,
+    void *arg)
+{
+	cbuf_uring_op_t *op;
+	struct io_uring_sqe *sqe;
+	struct iovec *iov;
+	int niov;
+
+	/*
+	 * The I/O vector must remain intact until the write completes.
+	 */
+	if ((iov = calloc(IOV_MAX, sizeof (*iov))) == NULL) {
+		return (-1);
+	}
+
+	if ((niov = cbufq_sys_iov(cbufq, iov, IOV_MAX)) == 0) {
+		free(iov);
+		errno = ENODATA;
+		return (-1);
+	}
+
+	if ((sqe = cbuf_uring_sqe(ring, &op)) == NULL) {
+		int e = errno;
+		free(iov);
+		errno = e;
+		return (-1);
+	}
+
+	sqe->opcode = IORING_OP_WRITEV;
+	sqe->fd = fd;
+	sqe->addr = (uintptr_t)iov;
+	sqe->len = (uint32_t)niov;
+	sqe->off = (uint64_t)-1;
+
+	op->cbuo_cbuf = NULL;
+	op->cbuo_cbufq = cbufq;
+	op->cbuo_iov = iov;
+	op->cbuo_arg = arg;
+	cbuf_uring_sqe_push(ring);
+
+	return (0);
+}
+
+/*
+ * Apply the result of a completed operation to its buffer or queue, as the
+ * equivalent synchronous call would have done, and release the slot.
+ */
+static void
+cbuf_uring_complete(cbuf_uring_t *ring, struct io_uring_cqe *cqe,
+    cbuf_uring_event_t *ev)
+{
+	VERIFY3U(cqe->user_data, <, ring->cbu_nops);
+	uint32_t idx = (uint32_t)cqe->user_data;
+	cbuf_uring_op_t *op = &ring->cbu_ops[idx];
+
+	bzero(ev, sizeof (*ev));
+	ev->cbue_cbuf = op->cbuo_cbuf;
+	ev->cbue_cbufq = op->cbuo_cbufq;
+	ev->cbue_arg = op->cbuo_arg;
+
+	if (cqe->res < 0) {
+		ev->cbue_error = -cqe->res;
+	} else {
+		ev->cbue_actual = (size_t)cqe->res;
+
+		if (op->cbuo_cbuf != NULL) {
+			VERIFY0(cbuf_position_set(op->cbuo_cbuf,
+			    op->cbuo_position + ev->cbue_actual));
+		} else {
+			cbufq_consume(op->cbuo_cbufq, ev->cbue_actual);
+		}
+	}
+
+	free(op->cbuo_iov);
+	bzero(op, sizeof (*op));
+	op->cbuo_next = ring->cbu_free_op;
+	ring->cbu_free_op = idx;
+}
+
+int
+cbuf_uring_reap(cbuf_uring_t *ring, cbuf_uring_event_t *events,
+    unsigned int max, unsigned int wait, unsigned int *reaped)
+{
+	uint32_t head = *ring->cbu_cq_head;
+	uint32_t tail = __atomic_load_n(ring->cbu_cq_tail, __ATOMIC_ACQUIRE);
+	unsigned int n = 0;
+
+	if (wait > max) {
+		wait = max;
+	}
+
+	/*
+	 * Submit anything outstanding and, if we do not already have enough
+	 * completions, wait for them, all in the one system call.
+	 */
+	if (ring->cbu_unsubmitted > 0 || tail - head < wait) {
+		unsigned int min = (tail - head < wait) ? wait : 0;
+		int r;
+
+		if ((r = cbuf_uring_enter(ring->cbu_fd, ring->cbu_unsubmitted,
+		    min, (min > 0) ? IORING_ENTER_GETEVENTS : 0)) < 0) {
+			return (-1);
+		}
+		VERIFY3U((unsigned int)r, <=, ring->cbu_unsubmitted);
+		ring->cbu_unsubmitted -= (unsigned int)r;
+
+		tail = __atomic_load_n(ring->cbu_cq_tail, __ATOMIC_ACQUIRE);
+	}
+
+	while (head != tail && n < max) {
+		cbuf_uring_complete(ring,
+		    &ring->cbu_cqes[head & ring->cbu_cq_mask], &events[n]);
+		head++;
+		n++;
+	}
+	__atomic_store_n(ring->cbu_cq_head, head, __ATOMIC_RELEASE);
+
+	if (reaped != NULL) {
+		*reaped = n;
+	}
+	return (0);
+}
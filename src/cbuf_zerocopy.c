@@ -0,0 +1,301 @@
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+
+#include "libcbuf_impl.h"
+#include "libcbuf.h"
+
+#define	CBUF_ZC_MINRECS		16
+
+int
+cbuf_zc_alloc(cbuf_zc_t **zcp, int fd, size_t threshold)
+{
+	cbuf_zc_t *zc;
+	int one = 1;
+
+	*zcp = NULL;
+
+	if (setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof (one)) != 0) {
+		return (-1);
+	}
+
+	if ((zc = calloc(1, sizeof (*zc))) == NULL) {
+		return (-1);
+	}
+	zc->cbzc_fd = fd;
+	zc->cbzc_threshold = threshold;
+
+	if (cbufq_alloc(&zc->cbzc_inflight) != 0) {
+		free(zc);
+		return (-1);
+	}
+
+	*zcp = zc;
+	return (0);
+}
+
+void
+cbuf_zc_free(cbuf_zc_t *zc)
+{
+	if (zc == NULL) {
+		return;
+	}
+
+	/*
+	 * The kernel may still be reading the memory of sends it has not yet
+	 * reported as complete, so it must not be freed.  Pick up any
+	 * completions that have arrived since the caller last looked.
+	 */
+	(void) cbuf_zc_reap(zc, NULL);
+	VERIFY3U(zc->cbzc_nrecs, ==, 0);
+
+	cbufq_free(zc->cbzc_inflight);
+	free(zc->cbzc_recs);
+	free(zc);
+}
+
+size_t
+cbuf_zc_inflight(cbuf_zc_t *zc)
+{
+	return (cbufq_available(zc->cbzc_inflight));
+}
+
+uint64_t
+cbuf_zc_copied(cbuf_zc_t *zc)
+{
+	return (zc->cbzc_copied);
+}
+
+static cbuf_zc_rec_t *
+cbuf_zc_rec(cbuf_zc_t *zc, uint32_t i)
+{
+	VERIFY3U(i, <, zc->cbzc_nrecs);
+	return (&zc->cbzc_recs[(zc->cbzc_rhead + i) % zc->cbzc_recsz]);
+}
+
+/*
+ * Make sure there is room to record one more send.
+ */
+static int
+cbuf_zc_rec_reserve(cbuf_zc_t *zc)
+{
+	cbuf_zc_rec_t *recs;
+	uint32_t newsz;
+
+	if (zc->cbzc_nrecs < zc->cbzc_recsz) {
+		return (0);
+	}
+
+	newsz = (zc->cbzc_recsz == 0) ? CBUF_ZC_MINRECS : zc->cbzc_recsz * 2;
+	if ((recs = calloc(newsz, sizeof (*recs))) == NULL) {
+		return (-1);
+	}
+	for (uint32_t i = 0; i < zc->cbzc_nrecs; i++) {
+		recs[i] = *cbuf_zc_rec(zc, i);
+	}
+
+	free(zc->cbzc_recs);
+	zc->cbzc_recs = recs;
+	zc->cbzc_recsz = newsz;
+	zc->cbzc_rhead = 0;
+	return (0);
+}
+
+/*
+ * Use sendmsg(2) to consume data from the queue.  If at least the threshold
+ * number of bytes is available, the send uses MSG_ZEROCOPY: each range is
+ * first held (see cbuf_hold()) on the in-flight queue, where it stays until
+ * the kernel reports that it has finished with the memory.
+ */
+int
+cbufq_zc_send(cbuf_zc_t *zc, cbufq_t *cbufq, int flags, size_t *actual)
+{
+	struct iovec iov[IOV_MAX];
+	size_t held = cbufq_available(zc->cbzc_inflight);
+	size_t inflight_count = cbufq_count(zc->cbzc_inflight);
+	bool zerocopy = cbufq_available(cbufq) >= zc->cbzc_threshold;
+	struct msghdr msg;
+	int niov = 0;
+
+	if (zerocopy && cbuf_zc_rec_reserve(zc) != 0) {
+		return (-1);
+	}
+
+	if (!zerocopy) {
+		niov = cbufq_sys_iov(cbufq, iov, IOV_MAX);
+	} else {
+		size_t total = 0;
+
+		for (cbuf_t *cbuf = list_head(&cbufq->cbufq_bufs);
+		    cbuf != NULL && niov < IOV_MAX;
+		    cbuf = list_next(&cbufq->cbufq_bufs, cbuf)) {
+			size_t avail = cbuf_available(cbuf);
+			cbuf_t *hold;
+
+			if (avail == 0) {
+				continue;
+			}
+			if (avail > SSIZE_MAX - total) {
+				if ((avail = SSIZE_MAX - total) == 0) {
+					break;
+				}
+			}
+
+			if (cbuf_hold(cbuf, &hold, cbuf_position(cbuf),
+			    avail) != 0) {
+				int e = errno;
+				cbufq_truncate(zc->cbzc_inflight, held);
+				errno = e;
+				return (-1);
+			}
+			cbufq_enq(zc->cbzc_inflight, hold);
+
+			iov[niov].iov_base = hold->cbuf_data;
+			iov[niov].iov_len = avail;
+			niov++;
+			total += avail;
+		}
+	}
+
+	if (niov == 0) {
+		errno = ENODATA;
+		return (-1);
+	}
+
+	bzero(&msg, sizeof (msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = niov;
+
+	ssize_t wsz = -1;
+	if (zerocopy && (wsz = sendmsg(zc->cbzc_fd, &msg,
+	    flags | MSG_ZEROCOPY)) < 0 && errno == ENOBUFS) {
+		/*
+		 * The kernel could not pin any more memory for this socket;
+		 * send a copy instead.  Some of the I/O vector may refer to
+		 * copies made by cbuf_hold(), so the holds are only dropped
+		 * once this send has returned.
+		 */
+		zerocopy = false;
+		wsz = sendmsg(zc->cbzc_fd, &msg, flags);
+		if (wsz >= 0) {
+			cbufq_truncate(zc->cbzc_inflight, held);
+		}
+	} else if (!zerocopy) {
+		wsz = sendmsg(zc->cbzc_fd, &msg, flags);
+	}
+
+	CBUF_STAT_SYS(CBUF_STAT_SYS_ZC_SEND, cbufq_iov_total(iov, niov), wsz);
+	if (wsz < 0) {
+		int e = errno;
+		cbufq_truncate(zc->cbzc_inflight, held);
+		errno = e;
+		return (-1);
+	}
+
+	if (zerocopy) {
+		/*
+		 * Keep the holds on the bytes that were sent, and record
+		 * them against the notification sequence number for this
+		 * call, which the kernel counts from 0.
+		 */
+		cbufq_truncate(zc->cbzc_inflight, held + (size_t)wsz);
+
+		uint32_t nbufs = (uint32_t)(cbufq_count(zc->cbzc_inflight) -
+		    inflight_count);
+		cbuf_zc_rec_t *rec = &zc->cbzc_recs[(zc->cbzc_rhead +
+		    zc->cbzc_nrecs) % zc->cbzc_recsz];
+
+		rec->cbzcr_nbufs = nbufs;
+		rec->cbzcr_done = false;
+		zc->cbzc_nrecs++;
+	}
+	cbufq_consume(cbufq, (size_t)wsz);
+
+	if (actual != NULL) {
+		*actual = (size_t)wsz;
+	}
+	return (0);
+}
+
+/*
+ * Mark the sends numbered "lo" to "hi" (inclusive) as complete.
+ */
+static void
+cbuf_zc_complete(cbuf_zc_t *zc, uint32_t lo, uint32_t hi)
+{
+	for (uint32_t seq = lo; ; seq++) {
+		uint32_t i = seq - zc->cbzc_head_seq;
+
+		if (i < zc->cbzc_nrecs) {
+			cbuf_zc_rec(zc, i)->cbzcr_done = true;
+		}
+
+		if (seq == hi) {
+			break;
+		}
+	}
+}
+
+int
+cbuf_zc_reap(cbuf_zc_t *zc, unsigned int *completed)
+{
+	unsigned int n = 0;
+
+	for (;;) {
+		uint8_t ctl[CMSG_SPACE(sizeof (struct sock_extended_err) +
+		    sizeof (struct sockaddr_in6))]
+		    __attribute__((aligned(sizeof (size_t))));
+		struct msghdr msg;
+
+		bzero(&msg, sizeof (msg));
+		msg.msg_control = ctl;
+		msg.msg_controllen = sizeof (ctl);
+
+		if (recvmsg(zc->cbzc_fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) <
+		    0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				break;
+			}
+			return (-1);
+		}
+
+		for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm != NULL;
+		    cm = CMSG_NXTHDR(&msg, cm)) {
+			struct sock_extended_err ee;
+
+			if (!(cm->cmsg_level == SOL_IP &&
+			    cm->cmsg_type == IP_RECVERR) &&
+			    !(cm->cmsg_level == SOL_IPV6 &&
+			    cm->cmsg_type == IPV6_RECVERR)) {
+				continue;
+			}
+
+			memcpy(&ee, CMSG_DATA(cm), sizeof (ee));
+			if (ee.ee_origin != SO_EE_ORIGIN_ZEROCOPY ||
+			    ee.ee_errno != 0) {
+				continue;
+			}
+
+			if (ee.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+				zc->cbzc_copied += ee.ee_data - ee.ee_info + 1;
+			}
+			cbuf_zc_complete(zc, ee.ee_info, ee.ee_data);
+		}
+	}
+
+	/*
+	 * Release the memory of completed sends, in order.
+	 */
+	while (zc->cbzc_nrecs > 0 && cbuf_zc_rec(zc, 0)->cbzcr_done) {
+		cbufq_drop(zc->cbzc_inflight, cbuf_zc_rec(zc, 0)->cbzcr_nbufs);
+
+		zc->cbzc_rhead = (zc->cbzc_rhead + 1) % zc->cbzc_recsz;
+		zc->cbzc_nrecs--;
+		zc->cbzc_head_seq++;
+		n++;
+	}
+
+	if (completed != NULL) {
+		*completed = n;
+	}
+	return (0);
+}
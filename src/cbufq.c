@@ -15,11 +15,76 @@ cbufq_alloc(cbufq_t **cbufqp)
 
 	list_create(&cbufq->cbufq_bufs, sizeof (cbuf_t), offsetof(cbuf_t,
 	    cbuf_link));
+	cbufq->cbufq_bufsize = CBUFQ_DEFAULT_BUFSIZE;
+	cbufq->cbufq_compact = CBUFQ_COMPACT_ALWAYS;
+	cbufq->cbufq_growth = CBUF_GROWTH_EXACT;
+	cbufq->cbufq_coalesce = CBUFQ_COALESCE_DEFAULT;
 
 	*cbufqp = cbufq;
 	return (0);
 }
 
+int
+cbufq_allocator_set(cbufq_t *cbufq, cbuf_pool_t *pool, size_t bufsize)
+{
+	if (bufsize == 0) {
+		errno = EINVAL;
+		return (-1);
+	}
+
+	cbufq->cbufq_pool = pool;
+	cbufq->cbufq_bufsize = bufsize;
+	return (0);
+}
+
+static int
+cbufq_buf_alloc(cbufq_t *cbufq, cbuf_t **cbufp)
+{
+	if (cbufq->cbufq_spare != NULL) {
+		cbuf_t *cbuf = cbufq->cbufq_spare;
+
+		/*
+		 * Leave the buffer as cbuf_alloc() would, without any state
+		 * from its last use.
+		 */
+		cbufq->cbufq_spare = NULL;
+		cbuf_clear(cbuf);
+		cbuf->cbuf_order = CBUF_ORDER_BIG_ENDIAN;
+		cbuf->cbuf_growth = CBUF_GROWTH_EXACT;
+		cbuf->cbuf_growth_max = 0;
+		cbuf->cbuf_csum = CBUF_CSUM_NONE;
+
+		*cbufp = cbuf;
+		return (0);
+	}
+
+	if (cbufq->cbufq_pool != NULL) {
+		return (cbuf_pool_alloc(cbufq->cbufq_pool, cbufp,
+		    cbufq->cbufq_bufsize));
+	}
+
+	return (cbuf_alloc(cbufp, cbufq->cbufq_bufsize));
+}
+
+/*
+ * Buffers that the queue itself has emptied are passed back here.  Buffers
+ * from a pool go back to the pool; otherwise we keep one spare buffer of
+ * about the right size for the next allocation.
+ */
+static void
+cbufq_buf_release(cbufq_t *cbufq, cbuf_t *cbuf)
+{
+	if (cbufq->cbufq_spare == NULL && cbuf->cbuf_pool_class == NULL &&
+	    cbuf->cbuf_store != CBUF_STORE_SHARED &&
+	    cbuf_capacity(cbuf) >= cbufq->cbufq_bufsize &&
+	    cbuf_capacity(cbuf) / 2 <= cbufq->cbufq_bufsize) {
+		cbufq->cbufq_spare = cbuf;
+		return;
+	}
+
+	cbuf_free(cbuf);
+}
+
 size_t
 cbufq_count(cbufq_t *cbufq)
 {
@@ -41,10 +106,82 @@ cbufq_free(cbufq_t *cbufq)
 	while ((cbuf = list_remove_head(&cbufq->cbufq_bufs)) != NULL) {
 		cbuf_free(cbuf);
 	}
+	cbuf_free(cbufq->cbufq_spare);
 
 	free(cbufq);
 }
 
+static bool
+cbufq_interior(cbufq_t *cbufq, cbuf_t *cbuf)
+{
+	return (cbuf != list_head(&cbufq->cbufq_bufs) &&
+	    cbuf != list_tail(&cbufq->cbufq_bufs));
+}
+
+/*
+ * Insert a buffer at the tail of the queue.  The previous tail buffer, if it
+ * is not also the head, becomes an interior buffer.
+ */
+static void
+cbufq_insert_tail(cbufq_t *cbufq, cbuf_t *cbuf)
+{
+	cbuf_t *tail = list_tail(&cbufq->cbufq_bufs);
+
+	if (tail != NULL && tail != list_head(&cbufq->cbufq_bufs)) {
+		VERIFY0(cbuf_safe_add(&cbufq->cbufq_bytes, cbufq->cbufq_bytes,
+		    cbuf_available(tail)));
+	}
+
+	cbufq->cbufq_count++;
+	list_insert_tail(&cbufq->cbufq_bufs, cbuf);
+}
+
+/*
+ * Remove any buffer from the queue.  If the head or tail buffer is removed,
+ * its neighbour (if interior) becomes the new head or tail.
+ */
+static void
+cbufq_remove(cbufq_t *cbufq, cbuf_t *cbuf)
+{
+	cbuf_t *head = list_head(&cbufq->cbufq_bufs);
+	cbuf_t *tail = list_tail(&cbufq->cbufq_bufs);
+	cbuf_t *leaving = NULL;
+
+	if (cbuf != head && cbuf != tail) {
+		leaving = cbuf;
+	} else if (cbuf == head && cbuf != tail) {
+		leaving = list_next(&cbufq->cbufq_bufs, cbuf);
+	} else if (cbuf == tail && cbuf != head) {
+		leaving = list_prev(&cbufq->cbufq_bufs, cbuf);
+	}
+
+	if (leaving != NULL && cbufq_interior(cbufq, leaving)) {
+		VERIFY3U(cbufq->cbufq_bytes, >=, cbuf_available(leaving));
+		cbufq->cbufq_bytes -= cbuf_available(leaving);
+	}
+
+	VERIFY3U(cbufq->cbufq_count, >=, 1);
+	cbufq->cbufq_count--;
+	list_remove(&cbufq->cbufq_bufs, cbuf);
+}
+
+/*
+ * The queue has changed the number of bytes available in a buffer, which
+ * previously had "before" bytes available.
+ */
+static void
+cbufq_update(cbufq_t *cbufq, cbuf_t *cbuf, size_t before)
+{
+	if (!cbufq_interior(cbufq, cbuf)) {
+		return;
+	}
+
+	VERIFY3U(cbufq->cbufq_bytes, >=, before);
+	cbufq->cbufq_bytes -= before;
+	VERIFY0(cbuf_safe_add(&cbufq->cbufq_bytes, cbufq->cbufq_bytes,
+	    cbuf_available(cbuf)));
+}
+
 void
 cbufq_enq(cbufq_t *cbufq, cbuf_t *cbuf)
 {
@@ -62,8 +199,198 @@ cbufq_enq(cbufq_t *cbufq, cbuf_t *cbuf)
 		VERIFY(cbufq->cbufq_count >= 1);
 	}
 
-	cbufq->cbufq_count++;
-	list_insert_tail(&cbufq->cbufq_bufs, cbuf);
+	cbufq_insert_tail(cbufq, cbuf);
+}
+
+void
+cbufq_coalesce_set(cbufq_t *cbufq, size_t threshold)
+{
+	cbufq->cbufq_coalesce = threshold;
+}
+
+void
+cbufq_compact_set(cbufq_t *cbufq, unsigned int mode)
+{
+	switch (mode) {
+	case CBUFQ_COMPACT_ALWAYS:
+	case CBUFQ_COMPACT_LAZY:
+		cbufq->cbufq_compact = mode;
+		break;
+
+	default:
+		abort();
+		break;
+	}
+}
+
+size_t
+cbufq_compact_bytes(cbufq_t *cbufq)
+{
+	return (cbufq->cbufq_compacted);
+}
+
+void
+cbufq_growth_set(cbufq_t *cbufq, unsigned int policy, size_t max_step)
+{
+	switch (policy) {
+	case CBUF_GROWTH_EXACT:
+	case CBUF_GROWTH_GEOMETRIC:
+	case CBUF_GROWTH_POW2:
+		cbufq->cbufq_growth = policy;
+		cbufq->cbufq_growth_max = max_step;
+		break;
+
+	default:
+		abort();
+		break;
+	}
+}
+
+/*
+ * Compact a buffer on behalf of the queue.  Unless "force" is set, a queue in
+ * the lazy compaction mode will only move the data if the consumed prefix of
+ * the buffer is more than half of its capacity.
+ */
+static void
+cbufq_compact_buf(cbufq_t *cbufq, cbuf_t *cbuf, bool force)
+{
+	size_t pos = cbuf_position(cbuf);
+
+	if (cbuf->cbuf_store == CBUF_STORE_RING ||
+	    cbuf->cbuf_store == CBUF_STORE_SHARED) {
+		/*
+		 * Compacting a ring buffer or a shared buffer does not move
+		 * any data.
+		 */
+		cbuf_compact(cbuf);
+		return;
+	}
+
+	if (!force && cbufq->cbufq_compact == CBUFQ_COMPACT_LAZY &&
+	    pos <= cbuf_capacity(cbuf) / 2) {
+		return;
+	}
+
+	if (pos > 0) {
+		VERIFY0(cbuf_safe_add(&cbufq->cbufq_compacted,
+		    cbufq->cbufq_compacted, cbuf_available(cbuf)));
+	}
+	cbuf_compact(cbuf);
+}
+
+/*
+ * Return the tail buffer, unless there is none we may copy into, having
+ * compacted it first if it has less than "len" bytes of unused space and that
+ * is cheap.
+ */
+static cbuf_t *
+cbufq_tail_room(cbufq_t *cbufq, size_t len)
+{
+	cbuf_t *tail = list_tail(&cbufq->cbufq_bufs);
+
+	if (tail == NULL || tail->cbuf_store == CBUF_STORE_SHARED) {
+		/*
+		 * The unused space in a shared buffer may hold data that is
+		 * visible through another buffer.
+		 */
+		return (NULL);
+	}
+
+	if (cbuf_unused(tail) < len &&
+	    cbuf_position(tail) > cbuf_available(tail)) {
+		/*
+		 * Compacting the buffer moves fewer bytes than it frees up.
+		 */
+		cbufq_compact_buf(cbufq, tail, true);
+	}
+
+	return (tail);
+}
+
+/*
+ * Copy bytes into the unused space at the end of the tail buffer.  The tail
+ * buffer is not included in the interior total, so its limit may be changed
+ * directly.
+ */
+static void
+cbufq_tail_copy(cbuf_t *tail, const void *data, size_t len)
+{
+	VERIFY3U(cbuf_unused(tail), >=, len);
+
+	memcpy(&tail->cbuf_data[tail->cbuf_limit], data, len);
+	tail->cbuf_limit += len;
+}
+
+int
+cbufq_append(cbufq_t *cbufq, const void *data, size_t len)
+{
+	const uint8_t *p = data;
+	cbuf_t *tail = cbufq_tail_room(cbufq, len);
+	size_t fit = (tail != NULL) ? cbuf_unused(tail) : 0;
+	cbuf_t *cbuf = NULL;
+
+	if (fit > len) {
+		fit = len;
+	}
+
+	/*
+	 * Allocate a buffer for whatever will not fit in the tail before
+	 * copying anything, so that we fail without changing the queue.
+	 */
+	size_t rest = len - fit;
+	if (rest > 0) {
+		int r;
+
+		if (rest <= cbufq->cbufq_bufsize) {
+			r = cbufq_buf_alloc(cbufq, &cbuf);
+		} else if (cbufq->cbufq_pool != NULL) {
+			r = cbuf_pool_alloc(cbufq->cbufq_pool, &cbuf, rest);
+		} else {
+			r = cbuf_alloc(&cbuf, rest);
+		}
+		if (r != 0) {
+			return (-1);
+		}
+	}
+
+	if (fit > 0) {
+		cbufq_tail_copy(tail, p, fit);
+	}
+
+	if (cbuf != NULL) {
+		VERIFY0(cbuf_limit_set(cbuf, rest));
+		memcpy(cbuf->cbuf_data, p + fit, rest);
+		cbufq_insert_tail(cbufq, cbuf);
+	}
+
+	return (0);
+}
+
+void
+cbufq_enq_coalesce(cbufq_t *cbufq, cbuf_t *cbuf)
+{
+	size_t len = cbuf_available(cbuf);
+	cbuf_t *tail;
+
+	VERIFY(!list_link_active(&cbuf->cbuf_link));
+	VERIFY(cbuf_position(cbuf) == 0);
+
+	if (len > cbufq->cbufq_coalesce ||
+	    (tail = list_tail(&cbufq->cbufq_bufs)) == NULL ||
+	    tail->cbuf_order != cbuf->cbuf_order ||
+	    cbuf_capacity(tail) - cbuf_available(tail) < len ||
+	    (tail = cbufq_tail_room(cbufq, len)) == NULL ||
+	    cbuf_unused(tail) < len) {
+		/*
+		 * The bytes of a buffer are decoded in its own byte order, so
+		 * we only copy them into a tail buffer with the same one.
+		 */
+		cbufq_enq(cbufq, cbuf);
+		return;
+	}
+
+	cbufq_tail_copy(tail, &cbuf->cbuf_data[0], len);
+	cbuf_free(cbuf);
 }
 
 static cbuf_t *
@@ -77,17 +404,25 @@ cbufq_deq_common(cbufq_t *cbufq, bool remove)
 	}
 
 	VERIFY(cbufq->cbufq_count >= 1);
+	head = list_head(&cbufq->cbufq_bufs);
 	if (remove) {
-		cbufq->cbufq_count--;
-		head = list_remove_head(&cbufq->cbufq_bufs);
-	} else {
-		head = list_head(&cbufq->cbufq_bufs);
+		cbufq_remove(cbufq, head);
+
+		if (cbufq->cbufq_compact == CBUFQ_COMPACT_LAZY) {
+			/*
+			 * The buffer now belongs to the caller, who has asked
+			 * us not to move its data around.
+			 */
+			return (head);
+		}
 	}
 
 	/*
-	 * Ensure the useful data in the buffer starts at index 0.
+	 * Ensure the useful data in the buffer starts at index 0.  In the lazy
+	 * mode, this only happens once enough of the buffer has been consumed
+	 * to make the copy worthwhile.
 	 */
-	cbuf_compact(head);
+	cbufq_compact_buf(cbufq, head, false);
 
 	return (head);
 }
@@ -115,21 +450,20 @@ cbufq_peek_tail(cbufq_t *cbufq)
 	VERIFY(cbufq->cbufq_count >= 1);
 	cbuf_t *tail = list_tail(&cbufq->cbufq_bufs);
 	if (tail != NULL) {
-		cbuf_compact(tail);
+		cbufq_compact_buf(cbufq, tail, false);
 	}
 
 	return (tail);
 }
 
 
-size_t
-cbufq_available(cbufq_t *cbufq)
+#ifdef	DEBUG
+static size_t
+cbufq_available_walk(cbufq_t *cbufq)
 {
 	size_t tots = 0;
 	cbuf_t *cbuf;
 
-	VERIFY3P(cbufq, !=, NULL);
-
 	for (cbuf = list_head(&cbufq->cbufq_bufs); cbuf != NULL;
 	    cbuf = list_next(&cbufq->cbufq_bufs, cbuf)) {
 		VERIFY0(cbuf_safe_add(&tots, tots, cbuf_available(cbuf)));
@@ -137,6 +471,119 @@ cbufq_available(cbufq_t *cbufq)
 
 	return (tots);
 }
+#endif
+
+size_t
+cbufq_available(cbufq_t *cbufq)
+{
+	VERIFY3P(cbufq, !=, NULL);
+
+	cbuf_t *head = list_head(&cbufq->cbufq_bufs);
+	cbuf_t *tail = list_tail(&cbufq->cbufq_bufs);
+	size_t tots = cbufq->cbufq_bytes;
+
+	if (head != NULL) {
+		VERIFY0(cbuf_safe_add(&tots, tots, cbuf_available(head)));
+	}
+	if (tail != NULL && tail != head) {
+		VERIFY0(cbuf_safe_add(&tots, tots, cbuf_available(tail)));
+	}
+
+#ifdef	DEBUG
+	VERIFY3U(tots, ==, cbufq_available_walk(cbufq));
+#endif
+
+	return (tots);
+}
+
+/*
+ * Move the bytes needed to satisfy a pullup into "dst", which is either the
+ * head buffer or a later buffer in the span whose backing store is large
+ * enough to hold them.  Buffers emptied in the process are released.
+ */
+static void
+cbufq_pullup_into(cbufq_t *cbufq, cbuf_t *dst, size_t min_contig)
+{
+	cbuf_t *head = list_head(&cbufq->cbufq_bufs);
+	size_t before = cbuf_available(dst);
+	size_t off;
+
+	if (dst != head) {
+		/*
+		 * Shift the donor buffer's own data along to make room for
+		 * the bytes from the buffers in front of it, and copy them in.
+		 */
+		size_t prefix = 0;
+		for (cbuf_t *cbuf = head; cbuf != dst; cbuf = list_next(
+		    &cbufq->cbufq_bufs, cbuf)) {
+			prefix += cbuf_available(cbuf);
+		}
+		VERIFY3U(prefix + before, <=, cbuf_capacity(dst));
+
+		memmove(&dst->cbuf_data[prefix],
+		    &dst->cbuf_data[dst->cbuf_position], before);
+		CBUF_STAT_ADD(cbs_pullup_bytes, before);
+
+		off = 0;
+		for (cbuf_t *cbuf = head; cbuf != dst; cbuf = list_next(
+		    &cbufq->cbufq_bufs, cbuf)) {
+			memcpy(&dst->cbuf_data[off],
+			    &cbuf->cbuf_data[cbuf->cbuf_position],
+			    cbuf_available(cbuf));
+			off += cbuf_available(cbuf);
+		}
+		CBUF_STAT_ADD(cbs_pullup_bytes, prefix);
+
+		dst->cbuf_position = 0;
+		dst->cbuf_limit = prefix + before;
+		dst->cbuf_order = head->cbuf_order;
+		cbufq_update(cbufq, dst, before);
+		before = cbuf_available(dst);
+	}
+
+	/*
+	 * Append bytes from the buffers after "dst" until we have enough.
+	 */
+	off = dst->cbuf_limit;
+	size_t need = (cbuf_available(dst) < min_contig) ?
+	    min_contig - cbuf_available(dst) : 0;
+	VERIFY3U(off + need, <=, cbuf_capacity(dst));
+
+	cbuf_t *cbuf = list_next(&cbufq->cbufq_bufs, dst);
+	while (need > 0) {
+		VERIFY3P(cbuf, !=, NULL);
+
+		cbuf_t *next = list_next(&cbufq->cbufq_bufs, cbuf);
+		size_t avail = cbuf_available(cbuf);
+		size_t take = (avail < need) ? avail : need;
+
+		memcpy(&dst->cbuf_data[off],
+		    &cbuf->cbuf_data[cbuf->cbuf_position], take);
+		off += take;
+		need -= take;
+		CBUF_STAT_ADD(cbs_pullup_bytes, take);
+
+		cbuf->cbuf_position += take;
+		cbufq_update(cbufq, cbuf, avail);
+		if (cbuf_available(cbuf) == 0) {
+			cbufq_remove(cbufq, cbuf);
+			cbufq_buf_release(cbufq, cbuf);
+		}
+
+		cbuf = next;
+	}
+
+	dst->cbuf_limit = off;
+	cbufq_update(cbufq, dst, before);
+
+	/*
+	 * Finally, discard the buffers that were copied into the donor.
+	 */
+	while ((cbuf = list_head(&cbufq->cbufq_bufs)) != dst) {
+		cbufq_remove(cbufq, cbuf);
+		cbufq_buf_release(cbufq, cbuf);
+	}
+}
 
 int
 cbufq_pullup(cbufq_t *cbufq, size_t min_contig)
@@ -145,90 +592,463 @@ cbufq_pullup(cbufq_t *cbufq, size_t min_contig)
 		return (0);
 	}
 
-top:
-	/*
-	 * Case 1: There are no buffers.
-	 */
-	if (cbufq->cbufq_count == 0) {
-		VERIFY(list_is_empty(&cbufq->cbufq_bufs));
+	cbuf_t *head = list_head(&cbufq->cbufq_bufs);
+	if (head == NULL) {
+		VERIFY(cbufq->cbufq_count == 0);
 
 		errno = ENODATA;
 		return (-1);
 	}
 
+	if (min_contig <= cbuf_available(head)) {
+		/*
+		 * The first buffer is long enough.
+		 */
+		return (0);
+	}
+
 	/*
-	 * Case 2: There is one buffer.
+	 * Walk the span of buffers that will make up the first "min_contig"
+	 * bytes, looking for a buffer after the head with enough backing
+	 * store to hold them all.  No changes are made until we know there is
+	 * enough data in the queue.
 	 */
-	if (cbufq->cbufq_count == 1) {
-		VERIFY(!list_is_empty(&cbufq->cbufq_bufs));
-		VERIFY(list_head(&cbufq->cbufq_bufs) ==
-		    list_tail(&cbufq->cbufq_bufs));
-
-		if (min_contig > cbuf_available(list_head(
-		    &cbufq->cbufq_bufs))) {
+	cbuf_t *donor = NULL;
+	size_t total = cbuf_available(head);
+	for (cbuf_t *cbuf = list_next(&cbufq->cbufq_bufs, head);
+	    total < min_contig; cbuf = list_next(&cbufq->cbufq_bufs, cbuf)) {
+		if (cbuf == NULL) {
 			errno = ENODATA;
 			return (-1);
 		}
 
-		return (0);
-	}
+		size_t need;
+		VERIFY0(cbuf_safe_add(&need, total, cbuf_available(cbuf)));
+		if (need < min_contig) {
+			need = min_contig;
+		}
+		if (donor == NULL && need <= cbuf_capacity(cbuf) &&
+		    cbuf->cbuf_store != CBUF_STORE_SHARED) {
+			donor = cbuf;
+		}
 
-	/*
-	 * Case 3: There are two or more buffers.
-	 */
-	VERIFY(!list_is_empty(&cbufq->cbufq_bufs));
-	VERIFY(list_head(&cbufq->cbufq_bufs) != list_tail(&cbufq->cbufq_bufs));
+		VERIFY0(cbuf_safe_add(&total, total, cbuf_available(cbuf)));
+	}
 
-	cbuf_t *cbuf0 = list_head(&cbufq->cbufq_bufs);
-	if (min_contig <= cbuf_available(cbuf0)) {
+	if (cbuf_available(head) == 0) {
 		/*
-		 * The first buffer is long enough.
+		 * The head buffer has been completely consumed, but
+		 * cbuf_compact() leaves an empty buffer alone.  Reset it.
 		 */
-		return (0);
+		VERIFY0(cbuf_limit_set(head, 0));
 	}
 
-	size_t sz;
-	VERIFY0(cbuf_safe_add(&sz, cbuf_available(cbuf0), cbuf_unused(cbuf0)));
-	if (min_contig > sz) {
+	if (head->cbuf_store == CBUF_STORE_SHARED) {
+		/*
+		 * Other buffers may refer to the backing store of the head
+		 * buffer, so copy its data to a private allocation first.
+		 */
+		cbufq_compact_buf(cbufq, head, true);
+		if (cbuf_dblk_unshare(head, (min_contig > cbuf_capacity(head)) ?
+		    min_contig : cbuf_capacity(head)) != 0) {
+			return (-1);
+		}
+		cbufq_pullup_into(cbufq, head, min_contig);
+	} else if (min_contig <= cbuf_capacity(head) - cbuf_position(head)) {
+		/*
+		 * There is room after the data in the head buffer.
+		 */
+		cbufq_pullup_into(cbufq, head, min_contig);
+	} else if (min_contig <= cbuf_capacity(head)) {
+		/*
+		 * There is room in the head buffer once it is compacted.
+		 */
+		cbufq_compact_buf(cbufq, head, true);
+		cbufq_pullup_into(cbufq, head, min_contig);
+	} else if (donor != NULL) {
+		cbufq_pullup_into(cbufq, donor, min_contig);
+	} else {
 		/*
-		 * The first buffer does not even have enough backing store to
-		 * allow for the requested minimum contiguous length.  Extend
-		 * the buffer.
-		 *
-		 * Note that when extending the buffer, we need to account for
-		 * any bytes in the first buffer that are before the position.
+		 * No buffer is large enough.  Extend the head buffer, under
+		 * the growth policy of the queue; it is compacted first so
+		 * that the bytes before the position need not be kept.
 		 */
-		size_t target;
-		VERIFY0(cbuf_safe_add(&target, min_contig,
-		    cbuf_position(cbuf0)));
-		if (cbuf_extend(cbuf0, target) != 0) {
+		cbufq_compact_buf(cbufq, head, true);
+		if (cbuf_extend_to(head, cbuf_growth_size(cbufq->cbufq_growth,
+		    cbufq->cbufq_growth_max, cbuf_capacity(head),
+		    min_contig)) != 0) {
 			return (-1);
 		}
+		cbufq_pullup_into(cbufq, head, min_contig);
+	}
+
+	VERIFY3U(cbuf_available(list_head(&cbufq->cbufq_bufs)), >=,
+	    min_contig);
+	return (0);
+}
+
+/*
+ * Fill out an I/O vector with the available bytes of each buffer in the
+ * queue, skipping any empty buffers.
+ */
+int
+cbufq_sys_iov(cbufq_t *cbufq, struct iovec *iov, int maxiov)
+{
+	size_t total = 0;
+	int niov = 0;
+
+	for (cbuf_t *cbuf = list_head(&cbufq->cbufq_bufs); cbuf != NULL &&
+	    niov < maxiov; cbuf = list_next(&cbufq->cbufq_bufs, cbuf)) {
+		size_t avail = cbuf_available(cbuf);
+
+		if (avail == 0) {
+			continue;
+		}
+
+		/*
+		 * The total length of the I/O vector must fit in an ssize_t.
+		 */
+		if (avail > SSIZE_MAX - total) {
+			if ((avail = SSIZE_MAX - total) == 0) {
+				break;
+			}
+		}
+		total += avail;
+
+		iov[niov].iov_base = &cbuf->cbuf_data[cbuf->cbuf_position];
+		iov[niov].iov_len = avail;
+		niov++;
+	}
+
+	return (niov);
+}
+
+#ifdef	CBUF_STATS
+size_t
+cbufq_iov_total(const struct iovec *iov, int niov)
+{
+	size_t total = 0;
+
+	for (int i = 0; i < niov; i++) {
+		total += iov[i].iov_len;
+	}
+
+	return (total);
+}
+#endif
+
+/*
+ * Consume "sz" bytes from the front of the queue, releasing any buffers that
+ * have been completely consumed.
+ */
+void
+cbufq_consume(cbufq_t *cbufq, size_t sz)
+{
+	cbuf_t *cbuf;
+
+	while ((cbuf = list_head(&cbufq->cbufq_bufs)) != NULL) {
+		size_t avail = cbuf_available(cbuf);
+
+		if (sz < avail) {
+			VERIFY0(cbuf_skip(cbuf, sz));
+			return;
+		}
+
+		sz -= avail;
+		cbufq_remove(cbufq, cbuf);
+		cbufq_buf_release(cbufq, cbuf);
+	}
+
+	VERIFY3U(sz, ==, 0);
+}
+
+int
+cbufq_split(cbufq_t *cbufq, cbufq_t *dst, size_t n)
+{
+	cbuf_t *slice = NULL;
+	cbuf_t *cbuf;
+	size_t left;
+
+	if (dst == cbufq) {
+		errno = EINVAL;
+		return (-1);
+	}
+
+	if (n > cbufq_available(cbufq)) {
+		errno = ENODATA;
+		return (-1);
 	}
 
 	/*
-	 * Preserve the original position for the first buffer in the queue; it
-	 * will be restored after the copying.  Resume putting to the buffer at
-	 * the current limit.
+	 * If the last byte falls within a buffer, hold those bytes (see
+	 * cbuf_hold()) before moving anything, as this is the only step that
+	 * can fail.  A buffer with embedded storage is not sliced, as that
+	 * would copy all of it and leave it shared for good; just the bytes
+	 * that move are copied instead.
 	 */
-	size_t pos0 = cbuf_position(cbuf0);
-	cbuf_resume(cbuf0);
+	left = n;
+	for (cbuf = list_head(&cbufq->cbufq_bufs); left > 0;
+	    cbuf = list_next(&cbufq->cbufq_bufs, cbuf)) {
+		VERIFY3P(cbuf, !=, NULL);
 
-	cbuf_t *cbuf1 = list_next(&cbufq->cbufq_bufs, cbuf0);
+		if (left < cbuf_available(cbuf)) {
+			if (cbuf_hold(cbuf, &slice, cbuf_position(cbuf),
+			    left) != 0) {
+				return (-1);
+			}
+			break;
+		}
+		left -= cbuf_available(cbuf);
+	}
+
+	left = n;
+	while (left > 0) {
+		cbuf = list_head(&cbufq->cbufq_bufs);
+		size_t avail = cbuf_available(cbuf);
+
+		if (left < avail) {
+			/*
+			 * The sliced buffer is now the head of the queue, so
+			 * its available bytes are not included in the interior
+			 * total.
+			 */
+			VERIFY3P(slice, !=, NULL);
+			VERIFY0(cbuf_skip(cbuf, left));
+			cbufq_enq(dst, slice);
+			break;
+		}
 
-	cbuf_copy(cbuf1, cbuf0);
-	if (cbuf_available(cbuf1) == 0) {
+		left -= avail;
+		cbufq_remove(cbufq, cbuf);
+		if (avail == 0) {
+			cbufq_buf_release(cbufq, cbuf);
+			continue;
+		}
+		cbufq_compact_buf(cbufq, cbuf, true);
+		cbufq_enq(dst, cbuf);
+	}
+
+	return (0);
+}
+
+/*
+ * Remove and release the first "count" buffers in the queue, whether or not
+ * they have any bytes available.
+ */
+void
+cbufq_drop(cbufq_t *cbufq, unsigned int count)
+{
+	for (unsigned int i = 0; i < count; i++) {
+		cbuf_t *cbuf = list_head(&cbufq->cbufq_bufs);
+
+		VERIFY3P(cbuf, !=, NULL);
+		cbufq_remove(cbufq, cbuf);
+		cbufq_buf_release(cbufq, cbuf);
+	}
+}
+
+/*
+ * Discard bytes from the end of the queue until only "len" bytes remain,
+ * releasing any buffers that are left empty.
+ */
+void
+cbufq_truncate(cbufq_t *cbufq, size_t len)
+{
+	size_t total = cbufq_available(cbufq);
+	cbuf_t *cbuf;
+
+	while (total > len && (cbuf = list_tail(&cbufq->cbufq_bufs)) != NULL) {
+		size_t avail = cbuf_available(cbuf);
+		size_t excess = total - len;
+
+		if (excess < avail) {
+			/*
+			 * The tail buffer is not included in the interior
+			 * total, so its limit may be changed directly.
+			 */
+			cbuf->cbuf_limit -= excess;
+			return;
+		}
+
+		total -= avail;
+		cbufq_remove(cbufq, cbuf);
+		cbufq_buf_release(cbufq, cbuf);
+	}
+
+	VERIFY3U(total, <=, len);
+}
+
+/*
+ * Use writev(2) to consume data from the queue.
+ */
+int
+cbufq_sys_writev(cbufq_t *cbufq, int fd, size_t *actual)
+{
+	struct iovec iov[IOV_MAX];
+	int niov;
+
+	if ((niov = cbufq_sys_iov(cbufq, iov, IOV_MAX)) == 0) {
+		errno = ENODATA;
+		return (-1);
+	}
+
+	ssize_t wsz = writev(fd, iov, niov);
+	CBUF_STAT_SYS(CBUF_STAT_SYS_WRITEV, cbufq_iov_total(iov, niov), wsz);
+	if (wsz < 0) {
+		return (-1);
+	}
+	cbufq_consume(cbufq, (size_t)wsz);
+
+	if (actual != NULL) {
+		*actual = (size_t)wsz;
+	}
+	return (0);
+}
+
+/*
+ * Use sendmsg(2) to consume data from the queue.
+ */
+int
+cbufq_sys_sendmsg(cbufq_t *cbufq, int fd, size_t *actual, int flags)
+{
+	struct iovec iov[IOV_MAX];
+	struct msghdr msg;
+	int niov;
+
+	if ((niov = cbufq_sys_iov(cbufq, iov, IOV_MAX)) == 0) {
+		errno = ENODATA;
+		return (-1);
+	}
+
+	bzero(&msg, sizeof (msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = niov;
+
+	ssize_t wsz = sendmsg(fd, &msg, flags);
+	CBUF_STAT_SYS(CBUF_STAT_SYS_SENDMSG, cbufq_iov_total(iov, niov), wsz);
+	if (wsz < 0) {
+		return (-1);
+	}
+	cbufq_consume(cbufq, (size_t)wsz);
+
+	if (actual != NULL) {
+		*actual = (size_t)wsz;
+	}
+	return (0);
+}
+
+/*
+ * Use readv(2) to append data to the queue.
+ */
+int
+cbufq_sys_readv(cbufq_t *cbufq, int fd, size_t max, size_t *actual)
+{
+	struct iovec iov[IOV_MAX];
+	cbuf_t *newbufs[IOV_MAX];
+	unsigned int nnew = 0;
+	size_t tailsz = 0;
+	int niov = 0;
+	int ret = -1;
+
+	if (max == 0) {
+		errno = EINVAL;
+		return (-1);
+	}
+	if (max > SSIZE_MAX) {
+		max = SSIZE_MAX;
+	}
+
+	/*
+	 * Start with any unused space at the end of the tail buffer.
+	 */
+	cbuf_t *tail = list_tail(&cbufq->cbufq_bufs);
+	if (tail != NULL && tail->cbuf_store == CBUF_STORE_SHARED) {
 		/*
-		 * Consign this buffer to the scrap heap, as it is now empty.
+		 * The unused space in a shared buffer may hold data that is
+		 * visible through another buffer.
 		 */
-		list_remove(&cbufq->cbufq_bufs, cbuf1);
-		cbufq->cbufq_count--;
-		cbuf_free(cbuf1);
+		tail = NULL;
+	}
+	if (tail != NULL && cbuf_unused(tail) < max &&
+	    cbuf_position(tail) > cbuf_available(tail)) {
+		/*
+		 * We need more space than is left at the end of the tail
+		 * buffer, and compacting it would move fewer bytes than it
+		 * frees up.
+		 */
+		cbufq_compact_buf(cbufq, tail, true);
+	}
+	if (tail != NULL && (tailsz = cbuf_unused(tail)) > 0) {
+		if (tailsz > max) {
+			tailsz = max;
+		}
+
+		iov[niov].iov_base = &tail->cbuf_data[tail->cbuf_limit];
+		iov[niov].iov_len = tailsz;
+		niov++;
+	}
+
+	size_t remaining = max - tailsz;
+	while (remaining > 0 && niov < IOV_MAX) {
+		cbuf_t *cbuf;
+
+		if (cbufq_buf_alloc(cbufq, &cbuf) != 0) {
+			goto out;
+		}
+		newbufs[nnew++] = cbuf;
+
+		size_t sz = cbuf_capacity(cbuf);
+		if (sz > remaining) {
+			sz = remaining;
+		}
+		remaining -= sz;
+
+		iov[niov].iov_base = cbuf->cbuf_data;
+		iov[niov].iov_len = sz;
+		niov++;
+	}
+
+	ssize_t rsz = readv(fd, iov, niov);
+	CBUF_STAT_SYS(CBUF_STAT_SYS_READV, max - remaining, rsz);
+	if (rsz < 0) {
+		goto out;
+	}
+
+	size_t left = (size_t)rsz;
+	if (tailsz > 0) {
+		size_t sz = (left < tailsz) ? left : tailsz;
+
+		VERIFY0(cbuf_limit_set(tail, tail->cbuf_limit + sz));
+		left -= sz;
+	}
+
+	for (unsigned int i = 0; i < nnew && left > 0; i++) {
+		cbuf_t *cbuf = newbufs[i];
+		size_t sz = (left < iov[niov - nnew + i].iov_len) ? left :
+		    iov[niov - nnew + i].iov_len;
+
+		VERIFY0(cbuf_limit_set(cbuf, sz));
+		cbufq_enq(cbufq, cbuf);
+		newbufs[i] = NULL;
+		left -= sz;
 	}
+	VERIFY3U(left, ==, 0);
 
-	cbuf_flip(cbuf0);
-	VERIFY0(cbuf_position_set(cbuf0, pos0));
-	goto top;
+	if (actual != NULL) {
+		*actual = (size_t)rsz;
+	}
+	ret = 0;
+
+out:
+	/*
+	 * Free any new buffers that did not receive data.
+	 */
+	for (unsigned int i = 0; i < nnew; i++) {
+		if (newbufs[i] != NULL) {
+			cbufq_buf_release(cbufq, newbufs[i]);
+		}
+	}
+	return (ret);
 }
 
 void
@@ -0,0 +1,211 @@
+#include "libcbuf_impl.h"
+#include "libcbuf.h"
+
+void
+cbufq_cursor_init(cbufq_cursor_t *cbc, cbufq_t *cbufq)
+{
+	cbuf_t *head = list_head(&cbufq->cbufq_bufs);
+
+	cbc->cbc_cbufq = cbufq;
+	cbc->cbc_cbuf = head;
+	cbc->cbc_offset = 0;
+	cbc->cbc_consumed = 0;
+
+	cbufq_cursor_mark(cbc);
+}
+
+/*
+ * Move the cursor on to the next buffer if it has reached the limit of the
+ * current one.  If the queue was empty when the cursor was initialised, pick
+ * up the head buffer now.
+ *
+ * The cursor offset is counted from the position of its buffer, rather than
+ * from the start of the data, so that it survives the compaction of a partly
+ * consumed head buffer when data is appended to it.
+ */
+static void
+cbufq_cursor_settle(cbufq_cursor_t *cbc)
+{
+	list_t *bufs = &cbc->cbc_cbufq->cbufq_bufs;
+
+	if (cbc->cbc_cbuf == NULL) {
+		VERIFY3U(cbc->cbc_consumed, ==, 0);
+		if ((cbc->cbc_cbuf = list_head(bufs)) == NULL) {
+			return;
+		}
+		cbc->cbc_offset = 0;
+	}
+
+	while (cbc->cbc_offset >= cbuf_available(cbc->cbc_cbuf)) {
+		cbuf_t *next = list_next(bufs, cbc->cbc_cbuf);
+
+		if (next == NULL) {
+			return;
+		}
+		cbc->cbc_cbuf = next;
+		cbc->cbc_offset = 0;
+	}
+}
+
+size_t
+cbufq_cursor_available(cbufq_cursor_t *cbc)
+{
+	size_t avail = cbufq_available(cbc->cbc_cbufq);
+
+	VERIFY3U(avail, >=, cbc->cbc_consumed);
+	return (avail - cbc->cbc_consumed);
+}
+
+size_t
+cbufq_cursor_consumed(cbufq_cursor_t *cbc)
+{
+	return (cbc->cbc_consumed);
+}
+
+/*
+ * Copy "len" bytes starting at the cursor into "buf" (if it is not NULL),
+ * and optionally advance the cursor past them.  If "orderp" is not NULL, it
+ * is set to the byte order of the buffer holding the first byte.
+ */
+static int
+cbufq_cursor_copy(cbufq_cursor_t *cbc, void *buf, size_t len, bool advance,
+    cbuf_order_t *orderp)
+{
+	if (len > cbufq_cursor_available(cbc)) {
+		errno = ENOSPC;
+		return (-1);
+	}
+
+	cbufq_cursor_settle(cbc);
+
+	list_t *bufs = &cbc->cbc_cbufq->cbufq_bufs;
+	cbuf_t *cbuf = cbc->cbc_cbuf;
+	size_t offset = cbc->cbc_offset;
+	uint8_t *dst = buf;
+	size_t left = len;
+
+	if (orderp != NULL) {
+		VERIFY3P(cbuf, !=, NULL);
+		*orderp = cbuf->cbuf_order;
+	}
+
+	while (left > 0) {
+		VERIFY3P(cbuf, !=, NULL);
+
+		if (offset >= cbuf_available(cbuf)) {
+			cbuf = list_next(bufs, cbuf);
+			VERIFY3P(cbuf, !=, NULL);
+			offset = 0;
+			continue;
+		}
+
+		size_t sz = cbuf_available(cbuf) - offset;
+		if (sz > left) {
+			sz = left;
+		}
+
+		if (dst != NULL) {
+			memcpy(dst, &cbuf->cbuf_data[cbuf_position(cbuf) + offset],
+			    sz);
+			dst += sz;
+		}
+		offset += sz;
+		left -= sz;
+	}
+
+	if (advance) {
+		cbc->cbc_cbuf = cbuf;
+		cbc->cbc_offset = offset;
+		cbc->cbc_consumed += len;
+	}
+
+	return (0);
+}
+
+int
+cbufq_cursor_get_bytes(cbufq_cursor_t *cbc, void *buf, size_t len)
+{
+	return (cbufq_cursor_copy(cbc, buf, len, true, NULL));
+}
+
+int
+cbufq_cursor_peek(cbufq_cursor_t *cbc, void *buf, size_t len)
+{
+	return (cbufq_cursor_copy(cbc, buf, len, false, NULL));
+}
+
+int
+cbufq_cursor_skip(cbufq_cursor_t *cbc, size_t skip_bytes)
+{
+	return (cbufq_cursor_copy(cbc, NULL, skip_bytes, true, NULL));
+}
+
+/*
+ * Get a value in the byte order of the buffer in which its first byte lies.
+ */
+#define	CBUFQ_CURSOR_GET_COMMON(cbc, val, bits)				\
+	do {								\
+		uint##bits##_t ival;					\
+		cbuf_order_t order;					\
+									\
+		if (cbufq_cursor_copy(cbc, &ival, sizeof (ival),	\
+		    true, &order) != 0) {				\
+			return (-1);					\
+		}							\
+									\
+		*val = (order == CBUF_ORDER_BIG_ENDIAN) ?		\
+		    be##bits##toh(ival) : le##bits##toh(ival);		\
+		return (0);						\
+	} while (0)
+
+int
+cbufq_cursor_get_u8(cbufq_cursor_t *cbc, uint8_t *val)
+{
+	return (cbufq_cursor_copy(cbc, val, sizeof (*val), true, NULL));
+}
+
+int
+cbufq_cursor_get_u16(cbufq_cursor_t *cbc, uint16_t *val)
+{
+	CBUFQ_CURSOR_GET_COMMON(cbc, val, 16);
+}
+
+int
+cbufq_cursor_get_u32(cbufq_cursor_t *cbc, uint32_t *val)
+{
+	CBUFQ_CURSOR_GET_COMMON(cbc, val, 32);
+}
+
+int
+cbufq_cursor_get_u64(cbufq_cursor_t *cbc, uint64_t *val)
+{
+	CBUFQ_CURSOR_GET_COMMON(cbc, val, 64);
+}
+
+void
+cbufq_cursor_mark(cbufq_cursor_t *cbc)
+{
+	cbc->cbc_mark_cbuf = cbc->cbc_cbuf;
+	cbc->cbc_mark_offset = cbc->cbc_offset;
+	cbc->cbc_mark_consumed = cbc->cbc_consumed;
+}
+
+void
+cbufq_cursor_rollback(cbufq_cursor_t *cbc)
+{
+	cbc->cbc_cbuf = cbc->cbc_mark_cbuf;
+	cbc->cbc_offset = cbc->cbc_mark_offset;
+	cbc->cbc_consumed = cbc->cbc_mark_consumed;
+}
+
+/*
+ * Consume everything before the cursor from the queue.  Buffers that are
+ * completely consumed are released, and the cursor (and its mark) are left at
+ * the new head of the queue.
+ */
+void
+cbufq_cursor_commit(cbufq_cursor_t *cbc)
+{
+	cbufq_consume(cbc->cbc_cbufq, cbc->cbc_consumed);
+	cbufq_cursor_init(cbc, cbc->cbc_cbufq);
+}
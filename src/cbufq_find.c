@@ -0,0 +1,150 @@
+#define	_GNU_SOURCE
+#include <string.h>
+
+#include "libcbuf_impl.h"
+#include "libcbuf.h"
+
+/*
+ * Check whether the needle matches the queue data starting at index "idx" of
+ * "cbuf", continuing into the following buffers as needed.
+ */
+static bool
+cbufq_find_match(cbufq_t *cbufq, cbuf_t *cbuf, size_t idx,
+    const uint8_t *needle, size_t len)
+{
+	while (len > 0) {
+		if (cbuf == NULL) {
+			return (false);
+		}
+
+		size_t n = cbuf_limit(cbuf) - idx;
+		if (n > len) {
+			n = len;
+		}
+		if (memcmp(&cbuf->cbuf_data[idx], needle, n) != 0) {
+			return (false);
+		}
+		needle += n;
+		len -= n;
+
+		cbuf = list_next(&cbufq->cbufq_bufs, cbuf);
+		idx = (cbuf != NULL) ? cbuf_position(cbuf) : 0;
+	}
+
+	return (true);
+}
+
+int
+cbufq_find(cbufq_t *cbufq, const void *needle, size_t len, size_t *offsetp)
+{
+	const uint8_t *ndl = needle;
+	size_t start = *offsetp;
+	size_t total = cbufq_available(cbufq);
+	size_t base = 0;
+
+	if (len == 0 || start > total) {
+		errno = EINVAL;
+		return (-1);
+	}
+
+	for (cbuf_t *cbuf = list_head(&cbufq->cbufq_bufs); cbuf != NULL;
+	    cbuf = list_next(&cbufq->cbufq_bufs, cbuf)) {
+		size_t avail = cbuf_available(cbuf);
+		const uint8_t *p = &cbuf->cbuf_data[cbuf->cbuf_position];
+
+		if (base + avail <= start) {
+			/*
+			 * This buffer was searched by an earlier call.
+			 */
+			base += avail;
+			continue;
+		}
+		size_t skip = (start > base) ? start - base : 0;
+
+		/*
+		 * Matches which lie entirely within this buffer all start
+		 * before any which straddle the end of it, so look for those
+		 * first.
+		 */
+		if (avail - skip >= len) {
+			const uint8_t *m;
+
+			if ((m = memmem(p + skip, avail - skip, ndl, len)) !=
+			    NULL) {
+				*offsetp = base + (size_t)(m - p);
+				return (0);
+			}
+			skip = avail - len + 1;
+		}
+
+		/*
+		 * Check each occurrence of the first byte of the needle in the
+		 * tail of the buffer for a match that continues into the
+		 * following buffers.
+		 */
+		while (skip < avail) {
+			const uint8_t *m;
+
+			if ((m = memchr(p + skip, ndl[0], avail - skip)) ==
+			    NULL) {
+				break;
+			}
+			skip = (size_t)(m - p);
+
+			if (cbufq_find_match(cbufq, cbuf,
+			    cbuf->cbuf_position + skip, ndl, len)) {
+				*offsetp = base + skip;
+				return (0);
+			}
+			skip++;
+		}
+
+		base += avail;
+	}
+
+	/*
+	 * A match may yet begin in the last "len - 1" bytes, once more data
+	 * has arrived, so the next search must resume before them.
+	 */
+	size_t resume = (total >= len - 1) ? total - (len - 1) : 0;
+	*offsetp = (resume > start) ? resume : start;
+
+	errno = ENOENT;
+	return (-1);
+}
+
+int
+cbufq_find_byte(cbufq_t *cbufq, uint8_t c, size_t *offsetp)
+{
+	size_t start = *offsetp;
+	size_t base = 0;
+
+	for (cbuf_t *cbuf = list_head(&cbufq->cbufq_bufs); cbuf != NULL;
+	    cbuf = list_next(&cbufq->cbufq_bufs, cbuf)) {
+		size_t avail = cbuf_available(cbuf);
+		const uint8_t *p = &cbuf->cbuf_data[cbuf->cbuf_position];
+
+		if (base + avail <= start) {
+			base += avail;
+			continue;
+		}
+		size_t skip = (start > base) ? start - base : 0;
+
+		const uint8_t *m;
+		if ((m = memchr(p + skip, c, avail - skip)) != NULL) {
+			*offsetp = base + (size_t)(m - p);
+			return (0);
+		}
+
+		base += avail;
+	}
+
+	if (start > base) {
+		errno = EINVAL;
+		return (-1);
+	}
+
+	*offsetp = base;
+	errno = ENOENT;
+	return (-1);
+}
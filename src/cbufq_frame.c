@@ -0,0 +1,107 @@
+#include "libcbuf_impl.h"
+#include "libcbuf.h"
+
+/*
+ * Decode a length prefix of "width" bytes in the given byte order.
+ */
+static uint32_t
+cbufq_frame_prefix(const uint8_t *p, unsigned int width, unsigned int order)
+{
+	uint16_t v16;
+	uint32_t v32;
+
+	switch (width) {
+	case 1:
+		return (p[0]);
+
+	case 2:
+		memcpy(&v16, p, sizeof (v16));
+		return ((order == CBUF_ORDER_BIG_ENDIAN) ? be16toh(v16) :
+		    le16toh(v16));
+
+	case 4:
+		memcpy(&v32, p, sizeof (v32));
+		return ((order == CBUF_ORDER_BIG_ENDIAN) ? be32toh(v32) :
+		    le32toh(v32));
+
+	default:
+		abort();
+		break;
+	}
+}
+
+int
+cbufq_frame_next(cbufq_t *cbufq, unsigned int width, unsigned int order,
+    size_t max_len, cbuf_t **framep)
+{
+	uint8_t prefix[4];
+	cbufq_cursor_t cbc;
+	cbuf_t *frame;
+
+	*framep = NULL;
+
+	if ((width != 1 && width != 2 && width != 4) ||
+	    (order != CBUF_ORDER_BIG_ENDIAN &&
+	    order != CBUF_ORDER_LITTLE_ENDIAN)) {
+		errno = EINVAL;
+		return (-1);
+	}
+
+	cbufq_cursor_init(&cbc, cbufq);
+	if (cbufq_cursor_peek(&cbc, prefix, width) != 0) {
+		errno = ENODATA;
+		return (-1);
+	}
+
+	/*
+	 * Check the length before we allocate anything, so that a corrupt
+	 * prefix cannot make us allocate a huge buffer.
+	 */
+	size_t len = cbufq_frame_prefix(prefix, width, order);
+	if (len > max_len) {
+		errno = EMSGSIZE;
+		return (-1);
+	}
+	if (len > cbufq_cursor_available(&cbc) - width) {
+		errno = ENODATA;
+		return (-1);
+	}
+
+	cbuf_t *head = list_head(&cbufq->cbufq_bufs);
+	while (cbuf_available(head) == 0) {
+		head = list_next(&cbufq->cbufq_bufs, head);
+	}
+
+	if (width + len <= cbuf_available(head) && cbuf_share_nocopy(head)) {
+		/*
+		 * The whole frame is in the first buffer with data, and its
+		 * storage can be shared as it is, so the caller gets a slice
+		 * of it rather than a copy.
+		 */
+		if (cbuf_slice(head, &frame, cbuf_position(head) + width,
+		    len) != 0) {
+			return (-1);
+		}
+		cbufq_consume(cbufq, width + len);
+	} else {
+		/*
+		 * The frame straddles buffers, or is in one whose storage
+		 * would have to be copied in full to share it; gather it into
+		 * one of exactly the right size.
+		 */
+		int r = (cbufq->cbufq_pool != NULL) ?
+		    cbuf_pool_alloc(cbufq->cbufq_pool, &frame, len) :
+		    cbuf_alloc(&frame, len);
+		if (r != 0) {
+			return (-1);
+		}
+
+		VERIFY0(cbufq_cursor_skip(&cbc, width));
+		VERIFY0(cbufq_cursor_get_bytes(&cbc, frame->cbuf_data, len));
+		cbufq_cursor_commit(&cbc);
+	}
+	cbuf_byteorder_set(frame, order);
+
+	*framep = frame;
+	return (0);
+}
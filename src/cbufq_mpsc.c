@@ -0,0 +1,140 @@
+#include "libcbuf_impl.h"
+#include "libcbuf.h"
+
+#define	CBUFQ_MPSC_NODE(cbuf)	(&(cbuf)->cbuf_link)
+#define	CBUFQ_MPSC_CBUF(node)	\
+	((cbuf_t *)((uintptr_t)(node) - offsetof(cbuf_t, cbuf_link)))
+
+int
+cbufq_mpsc_alloc(cbufq_mpsc_t **mpscp)
+{
+	cbufq_mpsc_t *mpsc;
+	void *mem;
+
+	*mpscp = NULL;
+
+	if ((errno = posix_memalign(&mem, CBUF_CACHE_LINE,
+	    sizeof (*mpsc))) != 0) {
+		return (-1);
+	}
+	mpsc = mem;
+	bzero(mpsc, sizeof (*mpsc));
+
+	mpsc->cbqm_head = &mpsc->cbqm_stub;
+	mpsc->cbqm_tail = &mpsc->cbqm_stub;
+
+	*mpscp = mpsc;
+	return (0);
+}
+
+void
+cbufq_mpsc_free(cbufq_mpsc_t *mpsc)
+{
+	cbuf_t *cbuf;
+
+	if (mpsc == NULL) {
+		return;
+	}
+
+	/*
+	 * Free any buffers left in the queue.
+	 */
+	while ((cbuf = cbufq_mpsc_deq(mpsc)) != NULL) {
+		cbuf_free(cbuf);
+	}
+	VERIFY3P(mpsc->cbqm_head, ==, mpsc->cbqm_tail);
+
+	free(mpsc);
+}
+
+static void
+cbufq_mpsc_push(cbufq_mpsc_t *mpsc, list_node_t *node)
+{
+	__atomic_store_n(&node->list_next, NULL, __ATOMIC_RELAXED);
+
+	list_node_t *prev = __atomic_exchange_n(&mpsc->cbqm_head, node,
+	    __ATOMIC_ACQ_REL);
+
+	/*
+	 * Until this store, the consumer cannot reach "node" (or anything
+	 * pushed after it) from "prev".
+	 */
+	__atomic_store_n(&prev->list_next, node, __ATOMIC_RELEASE);
+}
+
+void
+cbufq_mpsc_enq(cbufq_mpsc_t *mpsc, cbuf_t *cbuf)
+{
+	VERIFY(!list_link_active(&cbuf->cbuf_link));
+
+	/*
+	 * Ensure that either "cbuf_flip()", "cbuf_rewind()" or "cbuf_compact()"
+	 * has been called on this buffer before insertion in the queue.
+	 */
+	VERIFY(cbuf_position(cbuf) == 0);
+
+	cbufq_mpsc_push(mpsc, CBUFQ_MPSC_NODE(cbuf));
+}
+
+cbuf_t *
+cbufq_mpsc_deq(cbufq_mpsc_t *mpsc)
+{
+	list_node_t *tail = mpsc->cbqm_tail;
+	list_node_t *next = __atomic_load_n(&tail->list_next,
+	    __ATOMIC_ACQUIRE);
+
+	if (tail == &mpsc->cbqm_stub) {
+		/*
+		 * Skip over the stub.
+		 */
+		if (next == NULL) {
+			return (NULL);
+		}
+		mpsc->cbqm_tail = next;
+		tail = next;
+		next = __atomic_load_n(&tail->list_next, __ATOMIC_ACQUIRE);
+	}
+
+	if (next == NULL) {
+		/*
+		 * This appears to be the last node.  If a producer has swapped
+		 * in a new head but not yet linked it to this node, we cannot
+		 * take this node without losing the new one; try again later.
+		 */
+		if (tail != __atomic_load_n(&mpsc->cbqm_head,
+		    __ATOMIC_ACQUIRE)) {
+			return (NULL);
+		}
+
+		/*
+		 * Put the stub back on the end so that we can remove the last
+		 * buffer.
+		 */
+		cbufq_mpsc_push(mpsc, &mpsc->cbqm_stub);
+
+		if ((next = __atomic_load_n(&tail->list_next,
+		    __ATOMIC_ACQUIRE)) == NULL) {
+			return (NULL);
+		}
+	}
+
+	mpsc->cbqm_tail = next;
+
+	cbuf_t *cbuf = CBUFQ_MPSC_CBUF(tail);
+	list_link_init(&cbuf->cbuf_link);
+	return (cbuf);
+}
+
+size_t
+cbufq_mpsc_splice(cbufq_mpsc_t *mpsc, cbufq_t *cbufq)
+{
+	size_t count = 0;
+	cbuf_t *cbuf;
+
+	while ((cbuf = cbufq_mpsc_deq(mpsc)) != NULL) {
+		cbufq_enq(cbufq, cbuf);
+		count++;
+	}
+
+	return (count);
+}
@@ -0,0 +1,259 @@
+#include <sys/eventfd.h>
+
+#include "libcbuf_impl.h"
+#include "libcbuf.h"
+
+int
+cbufq_spsc_alloc(cbufq_spsc_t **spscp, size_t capacity, int flags)
+{
+	cbufq_spsc_t *spsc;
+	size_t ringsz = 1;
+	void *mem;
+
+	*spscp = NULL;
+
+	if (capacity == 0 || (flags & ~CBUFQ_SPSC_EVENTFD) != 0) {
+		errno = EINVAL;
+		return (-1);
+	}
+
+	while (ringsz < capacity) {
+		if (cbuf_safe_mul(&ringsz, ringsz, 2) != 0) {
+			return (-1);
+		}
+	}
+
+	if ((errno = posix_memalign(&mem, CBUF_CACHE_LINE,
+	    sizeof (*spsc))) != 0) {
+		return (-1);
+	}
+	spsc = mem;
+	bzero(spsc, sizeof (*spsc));
+	spsc->cbqs_mask = ringsz - 1;
+	spsc->cbqs_efd = -1;
+
+	if ((spsc->cbqs_ring = calloc(ringsz, sizeof (cbuf_t *))) == NULL) {
+		free(spsc);
+		return (-1);
+	}
+
+	if ((flags & CBUFQ_SPSC_EVENTFD) != 0 && (spsc->cbqs_efd = eventfd(0,
+	    EFD_CLOEXEC | EFD_NONBLOCK)) < 0) {
+		free(spsc->cbqs_ring);
+		free(spsc);
+		return (-1);
+	}
+
+	*spscp = spsc;
+	return (0);
+}
+
+void
+cbufq_spsc_free(cbufq_spsc_t *spsc)
+{
+	cbuf_t *cbuf;
+
+	if (spsc == NULL) {
+		return;
+	}
+
+	/*
+	 * Free any buffers left in the queue.
+	 */
+	while ((cbuf = cbufq_spsc_deq(spsc)) != NULL) {
+		cbuf_free(cbuf);
+	}
+
+	if (spsc->cbqs_efd >= 0) {
+		VERIFY0(close(spsc->cbqs_efd));
+	}
+	free(spsc->cbqs_ring);
+	free(spsc);
+}
+
+size_t
+cbufq_spsc_enq_batch(cbufq_spsc_t *spsc, cbuf_t **cbufs, size_t count)
+{
+	uint64_t tail = spsc->cbqs_prod.cbqsp_tail;
+	uint64_t ringsz = spsc->cbqs_mask + 1;
+	size_t bytes = spsc->cbqs_prod.cbqsp_bytes_in;
+
+	/*
+	 * Only look at the consumer's index if our cached copy suggests there
+	 * is not enough room.
+	 */
+	if (ringsz - (tail - spsc->cbqs_prod.cbqsp_head_cache) < count) {
+		spsc->cbqs_prod.cbqsp_head_cache = __atomic_load_n(
+		    &spsc->cbqs_cons.cbqsc_head, __ATOMIC_ACQUIRE);
+	}
+
+	size_t n = ringsz - (tail - spsc->cbqs_prod.cbqsp_head_cache);
+	if (n > count) {
+		n = count;
+	}
+
+	for (size_t i = 0; i < n; i++) {
+		cbuf_t *cbuf = cbufs[i];
+
+		VERIFY(!list_link_active(&cbuf->cbuf_link));
+		/*
+		 * Ensure that either "cbuf_flip()", "cbuf_rewind()" or
+		 * "cbuf_compact()" has been called on this buffer before
+		 * insertion in the queue.
+		 */
+		VERIFY(cbuf_position(cbuf) == 0);
+
+		spsc->cbqs_ring[(tail + i) & spsc->cbqs_mask] = cbuf;
+		bytes += cbuf_available(cbuf);
+	}
+
+	if (n == 0) {
+		return (0);
+	}
+
+	/*
+	 * The byte count must be updated before the buffers are published so
+	 * that it never appears to fall below the dequeued byte count.
+	 */
+	__atomic_store_n(&spsc->cbqs_prod.cbqsp_bytes_in, bytes,
+	    __ATOMIC_RELEASE);
+	__atomic_store_n(&spsc->cbqs_prod.cbqsp_tail, tail + n,
+	    __ATOMIC_RELEASE);
+
+	if (spsc->cbqs_efd >= 0) {
+		/*
+		 * Wake the consumer if the queue was empty.  The fence pairs
+		 * with the one in cbufq_spsc_deq_batch(): either we see that
+		 * the consumer has not yet emptied the queue, or the consumer
+		 * sees our new buffers before it decides to wait.
+		 */
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&spsc->cbqs_cons.cbqsc_head,
+		    __ATOMIC_RELAXED) == tail) {
+			uint64_t one = 1;
+
+			VERIFY3S(write(spsc->cbqs_efd, &one, sizeof (one)),
+			    ==, sizeof (one));
+		}
+	}
+
+	return (n);
+}
+
+int
+cbufq_spsc_enq(cbufq_spsc_t *spsc, cbuf_t *cbuf)
+{
+	if (cbufq_spsc_enq_batch(spsc, &cbuf, 1) != 1) {
+		errno = ENOSPC;
+		return (-1);
+	}
+
+	return (0);
+}
+
+size_t
+cbufq_spsc_deq_batch(cbufq_spsc_t *spsc, cbuf_t **cbufs, size_t count)
+{
+	uint64_t head = spsc->cbqs_cons.cbqsc_head;
+	size_t bytes = spsc->cbqs_cons.cbqsc_bytes_out;
+
+	/*
+	 * Only look at the producer's index if our cached copy suggests there
+	 * are not enough buffers.
+	 */
+	if (spsc->cbqs_cons.cbqsc_tail_cache - head < count) {
+		if (spsc->cbqs_efd >= 0) {
+			__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		}
+		spsc->cbqs_cons.cbqsc_tail_cache = __atomic_load_n(
+		    &spsc->cbqs_prod.cbqsp_tail, __ATOMIC_ACQUIRE);
+	}
+
+	size_t n = spsc->cbqs_cons.cbqsc_tail_cache - head;
+	if (n > count) {
+		n = count;
+	}
+
+	for (size_t i = 0; i < n; i++) {
+		cbuf_t *cbuf = spsc->cbqs_ring[(head + i) & spsc->cbqs_mask];
+
+		bytes += cbuf_available(cbuf);
+		cbufs[i] = cbuf;
+	}
+
+	if (n == 0) {
+		return (0);
+	}
+
+	__atomic_store_n(&spsc->cbqs_cons.cbqsc_head, head + n,
+	    __ATOMIC_RELEASE);
+	__atomic_store_n(&spsc->cbqs_cons.cbqsc_bytes_out, bytes,
+	    __ATOMIC_RELEASE);
+
+	return (n);
+}
+
+cbuf_t *
+cbufq_spsc_deq(cbufq_spsc_t *spsc)
+{
+	cbuf_t *cbuf;
+
+	if (cbufq_spsc_deq_batch(spsc, &cbuf, 1) != 1) {
+		return (NULL);
+	}
+
+	return (cbuf);
+}
+
+size_t
+cbufq_spsc_available(cbufq_spsc_t *spsc)
+{
+	/*
+	 * Load the dequeued count first: bytes are always counted in before
+	 * they are counted out, so the difference cannot be negative.
+	 */
+	size_t out = __atomic_load_n(&spsc->cbqs_cons.cbqsc_bytes_out,
+	    __ATOMIC_ACQUIRE);
+	size_t in = __atomic_load_n(&spsc->cbqs_prod.cbqsp_bytes_in,
+	    __ATOMIC_ACQUIRE);
+
+	VERIFY3U(in, >=, out);
+	return (in - out);
+}
+
+size_t
+cbufq_spsc_count(cbufq_spsc_t *spsc)
+{
+	uint64_t head = __atomic_load_n(&spsc->cbqs_cons.cbqsc_head,
+	    __ATOMIC_ACQUIRE);
+	uint64_t tail = __atomic_load_n(&spsc->cbqs_prod.cbqsp_tail,
+	    __ATOMIC_ACQUIRE);
+
+	VERIFY3U(tail, >=, head);
+	return ((size_t)(tail - head));
+}
+
+int
+cbufq_spsc_fd(cbufq_spsc_t *spsc)
+{
+	if (spsc->cbqs_efd < 0) {
+		errno = ENOTSUP;
+		return (-1);
+	}
+
+	return (spsc->cbqs_efd);
+}
+
+void
+cbufq_spsc_fd_clear(cbufq_spsc_t *spsc)
+{
+	uint64_t val;
+
+	if (spsc->cbqs_efd < 0) {
+		return;
+	}
+
+	if (read(spsc->cbqs_efd, &val, sizeof (val)) < 0) {
+		VERIFY3S(errno, ==, EAGAIN);
+	}
+}
@@ -0,0 +1,190 @@
+/*
+ * Known-answer tests for the CRC-32C and Internet checksums.  The checksum
+ * source is included directly, so that both CRC kernels can be called
+ * whichever one the CPU would select.
+ */
+
+#include "cbuf_csum.c"
+
+#define	TEST_CHECK(cond)						\
+	do {								\
+		if (!(cond)) {						\
+			fprintf(stderr, "%s:%d: check failed: %s\n",	\
+			    __FILE__, __LINE__, #cond);			\
+			exit(1);					\
+		}							\
+	} while (0)
+
+#define	TEST_CRC_CHECK		0xe3069283U	/* CRC-32C of "123456789" */
+
+static cbuf_t *
+test_buf(const uint8_t *data, size_t len)
+{
+	cbuf_t *cbuf;
+
+	TEST_CHECK(cbuf_alloc(&cbuf, len) == 0);
+	for (size_t i = 0; i < len; i++) {
+		TEST_CHECK(cbuf_put_u8(cbuf, data[i]) == 0);
+	}
+	cbuf_flip(cbuf);
+	return (cbuf);
+}
+
+static void
+test_crc32c_kernels(void)
+{
+	const uint8_t *check = (const uint8_t *)"123456789";
+	uint8_t data[1024];
+
+	cbuf_crc32c_table_init();
+	TEST_CHECK(~cbuf_crc32c_portable(~0U, check, 9) == TEST_CRC_CHECK);
+
+#ifdef	CBUF_CRC_X86
+	__builtin_cpu_init();
+	if (!__builtin_cpu_supports("sse4.2")) {
+		return;
+	}
+	TEST_CHECK(~cbuf_crc32c_sse42(~0U, check, 9) == TEST_CRC_CHECK);
+
+	/*
+	 * The kernels must agree for every length and alignment.
+	 */
+	for (size_t i = 0; i < sizeof (data); i++) {
+		data[i] = (uint8_t)(i * 31 + 7);
+	}
+	for (size_t off = 0; off < 8; off++) {
+		for (size_t len = 0; len + off <= sizeof (data); len += 13) {
+			TEST_CHECK(cbuf_crc32c_portable(0x1234U, &data[off],
+			    len) == cbuf_crc32c_sse42(0x1234U, &data[off],
+			    len));
+		}
+	}
+#else
+	(void) data;
+#endif
+}
+
+static void
+test_crc32c(void)
+{
+	const uint8_t *check = (const uint8_t *)"123456789";
+	cbuf_t *cbuf = test_buf(check, 9);
+	uint32_t crc = 0;
+
+	TEST_CHECK(cbuf_crc32c(cbuf, 0, 9, &crc) == 0);
+	TEST_CHECK(crc == TEST_CRC_CHECK);
+
+	/*
+	 * A CRC may be continued from where an earlier one left off.
+	 */
+	crc = 0;
+	TEST_CHECK(cbuf_crc32c(cbuf, 0, 4, &crc) == 0);
+	TEST_CHECK(cbuf_crc32c(cbuf, 4, 5, &crc) == 0);
+	TEST_CHECK(crc == TEST_CRC_CHECK);
+
+	TEST_CHECK(cbuf_crc32c(cbuf, 5, 5, &crc) == -1 && errno == EOVERFLOW);
+	cbuf_free(cbuf);
+}
+
+/*
+ * The example of RFC 1071, section 3: the one's complement sum of these
+ * bytes is 0xddf2, so the checksum is 0x220d.
+ */
+static void
+test_inet_rfc1071(void)
+{
+	const uint8_t data[] = { 0x00, 0x01, 0xf2, 0x03, 0xf4, 0xf5, 0xf6,
+	    0xf7 };
+	cbuf_t *cbuf = test_buf(data, sizeof (data));
+	uint16_t csum;
+
+	TEST_CHECK(cbuf_inet_csum(cbuf, 0, sizeof (data), &csum) == 0);
+	TEST_CHECK(csum == 0x220d);
+	cbuf_free(cbuf);
+}
+
+/*
+ * Checksums over a queue of odd-length buffers must match those over the
+ * same bytes in one buffer, so words which straddle buffers are summed
+ * correctly.
+ */
+static void
+test_queue(void)
+{
+	const size_t lens[] = { 3, 1, 5, 7, 2, 9, 1, 11 };
+	uint8_t data[64];
+	size_t total = 0;
+	cbufq_t *cbufq;
+	cbuf_t *cbuf;
+
+	for (size_t i = 0; i < sizeof (data); i++) {
+		data[i] = (uint8_t)(0xff - i * 37);
+	}
+
+	TEST_CHECK(cbufq_alloc(&cbufq) == 0);
+	for (size_t i = 0; i < sizeof (lens) / sizeof (lens[0]); i++) {
+		cbufq_enq(cbufq, test_buf(&data[total], lens[i]));
+		total += lens[i];
+	}
+	cbuf = test_buf(data, total);
+
+	for (size_t len = 0; len <= total; len++) {
+		uint16_t qsum, bsum;
+		uint32_t qcrc = 0, bcrc = 0;
+
+		TEST_CHECK(cbufq_inet_csum(cbufq, len, &qsum) == 0);
+		TEST_CHECK(cbuf_inet_csum(cbuf, 0, len, &bsum) == 0);
+		TEST_CHECK(qsum == bsum);
+
+		TEST_CHECK(cbufq_crc32c(cbufq, len, &qcrc) == 0);
+		TEST_CHECK(cbuf_crc32c(cbuf, 0, len, &bcrc) == 0);
+		TEST_CHECK(qcrc == bcrc);
+	}
+
+	TEST_CHECK(cbufq_crc32c(cbufq, total + 1, &(uint32_t){ 0 }) == -1 &&
+	    errno == ENODATA);
+
+	cbuf_free(cbuf);
+	cbufq_free(cbufq);
+}
+
+/*
+ * A running checksum over bytes put in several steps matches one over the
+ * same bytes at once.
+ */
+static void
+test_running(void)
+{
+	const uint8_t *check = (const uint8_t *)"123456789";
+	uint32_t val;
+	cbuf_t *cbuf;
+
+	TEST_CHECK(cbuf_alloc(&cbuf, 64) == 0);
+	TEST_CHECK(cbuf_csum_value(cbuf, &val) == -1 && errno == EINVAL);
+
+	TEST_CHECK(cbuf_put_u8(cbuf, 0xaa) == 0);
+	cbuf_csum_start(cbuf, CBUF_CSUM_CRC32C);
+	for (size_t i = 0; i < 9; i++) {
+		TEST_CHECK(cbuf_put_u8(cbuf, check[i]) == 0);
+		if (i == 2 || i == 6) {
+			TEST_CHECK(cbuf_csum_value(cbuf, &val) == 0);
+		}
+	}
+	TEST_CHECK(cbuf_csum_value(cbuf, &val) == 0);
+	TEST_CHECK(val == TEST_CRC_CHECK);
+
+	cbuf_free(cbuf);
+}
+
+int
+main(void)
+{
+	test_crc32c_kernels();
+	test_crc32c();
+	test_inet_rfc1071();
+	test_queue();
+	test_running();
+
+	printf("ok\n");
+	return (0);
+}
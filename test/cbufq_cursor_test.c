@@ -0,0 +1,151 @@
+/*
+ * Check that a queue cursor picks up data that arrives after it was
+ * initialised on an empty queue, and that it keeps its place when data is
+ * appended to a partly consumed head buffer.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "libcbuf.h"
+
+#define	TEST_CHECK(cond)						\
+	do {								\
+		if (!(cond)) {						\
+			fprintf(stderr, "%s:%d: check failed: %s\n",	\
+			    __FILE__, __LINE__, #cond);			\
+			exit(1);					\
+		}							\
+	} while (0)
+
+static cbuf_t *
+test_buf(const char *str)
+{
+	size_t len = strlen(str);
+	cbuf_t *cbuf;
+
+	TEST_CHECK(cbuf_alloc(&cbuf, len) == 0);
+	for (size_t i = 0; i < len; i++) {
+		TEST_CHECK(cbuf_put_u8(cbuf, (uint8_t)str[i]) == 0);
+	}
+	cbuf_flip(cbuf);
+	return (cbuf);
+}
+
+/*
+ * A cursor initialised on an empty queue reads the first buffer enqueued.
+ */
+static void
+test_init_empty(void)
+{
+	cbufq_cursor_t cbc;
+	cbufq_t *cbufq;
+	uint8_t u8;
+	uint16_t u16;
+
+	TEST_CHECK(cbufq_alloc(&cbufq) == 0);
+	cbufq_cursor_init(&cbc, cbufq);
+	TEST_CHECK(cbufq_cursor_get_u8(&cbc, &u8) == -1);
+
+	cbufq_enq(cbufq, test_buf("\x01\x02\x03"));
+	TEST_CHECK(cbufq_cursor_get_u8(&cbc, &u8) == 0 && u8 == 0x01);
+	TEST_CHECK(cbufq_cursor_get_u16(&cbc, &u16) == 0 && u16 == 0x0203);
+
+	cbufq_free(cbufq);
+}
+
+/*
+ * Committing everything leaves the cursor on an empty queue, from which it
+ * reads whatever is appended next.
+ */
+static void
+test_commit_empty(void)
+{
+	cbufq_cursor_t cbc;
+	cbufq_t *cbufq;
+	char buf[4];
+
+	TEST_CHECK(cbufq_alloc(&cbufq) == 0);
+	TEST_CHECK(cbufq_append(cbufq, "abcd", 4) == 0);
+
+	cbufq_cursor_init(&cbc, cbufq);
+	TEST_CHECK(cbufq_cursor_get_bytes(&cbc, buf, 4) == 0);
+	TEST_CHECK(memcmp(buf, "abcd", 4) == 0);
+	cbufq_cursor_commit(&cbc);
+	TEST_CHECK(cbufq_available(cbufq) == 0);
+
+	TEST_CHECK(cbufq_cursor_peek(&cbc, buf, 1) == -1);
+	TEST_CHECK(cbufq_append(cbufq, "wxyz", 4) == 0);
+	TEST_CHECK(cbufq_cursor_get_bytes(&cbc, buf, 4) == 0);
+	TEST_CHECK(memcmp(buf, "wxyz", 4) == 0);
+
+	cbufq_free(cbufq);
+}
+
+/*
+ * Appending to a full, partly consumed head buffer compacts it; the cursor
+ * must still find the bytes it has not yet read.
+ */
+static void
+test_append_compact(void)
+{
+	cbufq_cursor_t cbc;
+	cbufq_t *cbufq;
+	char buf[12];
+	size_t actual;
+	int fds[2];
+
+	TEST_CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+	TEST_CHECK(cbufq_alloc(&cbufq) == 0);
+	TEST_CHECK(cbufq_allocator_set(cbufq, NULL, 16) == 0);
+
+	TEST_CHECK(write(fds[1], "0123456789ABCDEF", 16) == 16);
+	TEST_CHECK(cbufq_sys_readv(cbufq, fds[0], 16, &actual) == 0);
+	TEST_CHECK(actual == 16 && cbufq_count(cbufq) == 1);
+
+	cbufq_cursor_init(&cbc, cbufq);
+	TEST_CHECK(cbufq_cursor_skip(&cbc, 12) == 0);
+	cbufq_cursor_commit(&cbc);
+	TEST_CHECK(cbufq_cursor_get_bytes(&cbc, buf, 2) == 0);
+	TEST_CHECK(memcmp(buf, "CD", 2) == 0);
+
+	TEST_CHECK(write(fds[1], "xyzw", 4) == 4);
+	TEST_CHECK(cbufq_sys_readv(cbufq, fds[0], 4, &actual) == 0);
+	TEST_CHECK(actual == 4 && cbufq_count(cbufq) == 1);
+	TEST_CHECK(cbufq_cursor_get_bytes(&cbc, buf, 6) == 0);
+	TEST_CHECK(memcmp(buf, "EFxyzw", 6) == 0);
+
+	cbufq_cursor_commit(&cbc);
+	TEST_CHECK(cbufq_available(cbufq) == 0);
+
+	TEST_CHECK(cbufq_append(cbufq, "0123456789ABCDEF", 16) == 0);
+	TEST_CHECK(cbufq_cursor_skip(&cbc, 12) == 0);
+	cbufq_cursor_commit(&cbc);
+	TEST_CHECK(cbufq_cursor_get_bytes(&cbc, buf, 2) == 0);
+	TEST_CHECK(memcmp(buf, "CD", 2) == 0);
+
+	TEST_CHECK(cbufq_append(cbufq, "0123456789", 10) == 0);
+	TEST_CHECK(cbufq_count(cbufq) == 1);
+	TEST_CHECK(cbufq_cursor_get_bytes(&cbc, buf, 12) == 0);
+	TEST_CHECK(memcmp(buf, "EF0123456789", 12) == 0);
+
+	cbufq_free(cbufq);
+	(void) close(fds[0]);
+	(void) close(fds[1]);
+}
+
+int
+main(void)
+{
+	test_init_empty();
+	test_commit_empty();
+	test_append_compact();
+
+	printf("ok\n");
+	return (0);
+}
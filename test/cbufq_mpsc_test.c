@@ -0,0 +1,130 @@
+/*
+ * Stress a multiple-producer, single-consumer queue with several producer
+ * threads.  The consumer takes buffers both one at a time and by splicing them
+ * onto an ordinary queue.  Every buffer must arrive exactly once, and the
+ * buffers of each producer must arrive in the order it enqueued them.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/socket.h>
+
+#include "libcbuf.h"
+
+#define	TEST_CHECK(cond)						\
+	do {								\
+		if (!(cond)) {						\
+			fprintf(stderr, "%s:%d: check failed: %s\n",	\
+			    __FILE__, __LINE__, #cond);			\
+			exit(1);					\
+		}							\
+	} while (0)
+
+#define	TEST_PRODUCERS		4
+#define	TEST_BUFS		100000	/* per producer */
+
+typedef struct test_producer {
+	pthread_t tp_thread;
+	cbufq_mpsc_t *tp_mpsc;
+	uint32_t tp_id;
+} test_producer_t;
+
+static void *
+test_producer(void *arg)
+{
+	test_producer_t *tp = arg;
+
+	for (uint32_t seq = 0; seq < TEST_BUFS; seq++) {
+		cbuf_t *cbuf;
+
+		TEST_CHECK(cbuf_alloc(&cbuf, 2 * sizeof (uint32_t)) == 0);
+		TEST_CHECK(cbuf_put_u32(cbuf, tp->tp_id) == 0);
+		TEST_CHECK(cbuf_put_u32(cbuf, seq) == 0);
+		cbuf_flip(cbuf);
+		cbufq_mpsc_enq(tp->tp_mpsc, cbuf);
+
+		if (seq % 1000 == 0) {
+			(void) sched_yield();
+		}
+	}
+
+	return (NULL);
+}
+
+static void
+test_check(cbuf_t *cbuf, uint32_t *next, size_t *total)
+{
+	uint32_t id, seq;
+
+	TEST_CHECK(cbuf_get_u32(cbuf, &id) == 0);
+	TEST_CHECK(cbuf_get_u32(cbuf, &seq) == 0);
+	TEST_CHECK(id < TEST_PRODUCERS);
+	TEST_CHECK(seq == next[id]);
+	next[id]++;
+	(*total)++;
+	cbuf_free(cbuf);
+}
+
+int
+main(void)
+{
+	test_producer_t tp[TEST_PRODUCERS];
+	uint32_t next[TEST_PRODUCERS] = { 0 };
+	size_t total = 0, splices = 0;
+	cbufq_mpsc_t *mpsc;
+	cbufq_t *cbufq;
+	cbuf_t *cbuf;
+
+	TEST_CHECK(cbufq_mpsc_alloc(&mpsc) == 0);
+	TEST_CHECK(cbufq_alloc(&cbufq) == 0);
+
+	for (uint32_t p = 0; p < TEST_PRODUCERS; p++) {
+		tp[p].tp_mpsc = mpsc;
+		tp[p].tp_id = p;
+		TEST_CHECK(pthread_create(&tp[p].tp_thread, NULL,
+		    test_producer, &tp[p]) == 0);
+	}
+
+	while (total < (size_t)TEST_PRODUCERS * TEST_BUFS) {
+		size_t n;
+
+		/*
+		 * Alternate between taking a single buffer and splicing
+		 * whatever else is pending onto the ordinary queue.
+		 */
+		if ((cbuf = cbufq_mpsc_deq(mpsc)) != NULL) {
+			test_check(cbuf, next, &total);
+		}
+
+		n = cbufq_mpsc_splice(mpsc, cbufq);
+		TEST_CHECK(cbufq_count(cbufq) == n);
+		if (n > 0) {
+			splices++;
+		}
+		while ((cbuf = cbufq_deq(cbufq)) != NULL) {
+			test_check(cbuf, next, &total);
+		}
+
+		if (n == 0) {
+			(void) sched_yield();
+		}
+	}
+
+	for (uint32_t p = 0; p < TEST_PRODUCERS; p++) {
+		TEST_CHECK(pthread_join(tp[p].tp_thread, NULL) == 0);
+		TEST_CHECK(next[p] == TEST_BUFS);
+	}
+	TEST_CHECK(cbufq_mpsc_deq(mpsc) == NULL);
+	TEST_CHECK(cbufq_mpsc_splice(mpsc, cbufq) == 0);
+
+	cbufq_free(cbufq);
+	cbufq_mpsc_free(mpsc);
+
+	printf("ok (%u producers, %u buffers each, %zu splices)\n",
+	    (unsigned int)TEST_PRODUCERS, (unsigned int)TEST_BUFS, splices);
+	return (0);
+}
@@ -0,0 +1,122 @@
+/*
+ * Check that splitting a queue inside a buffer with embedded storage (a small
+ * buffer, or one from a pool) moves the right bytes, and leaves the buffer
+ * unshared so that later appends still go into it.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "libcbuf.h"
+
+#define	TEST_CHECK(cond)						\
+	do {								\
+		if (!(cond)) {						\
+			fprintf(stderr, "%s:%d: check failed: %s\n",	\
+			    __FILE__, __LINE__, #cond);			\
+			exit(1);					\
+		}							\
+	} while (0)
+
+static void
+test_get(cbufq_t *cbufq, const char *want)
+{
+	size_t len = strlen(want);
+	cbufq_cursor_t cbc;
+	char buf[64];
+
+	TEST_CHECK(cbufq_available(cbufq) == len);
+	cbufq_cursor_init(&cbc, cbufq);
+	TEST_CHECK(cbufq_cursor_get_bytes(&cbc, buf, len) == 0);
+	TEST_CHECK(memcmp(buf, want, len) == 0);
+}
+
+/*
+ * Split "cbufq", which holds a single buffer with "abcdefgh", inside that
+ * buffer.
+ */
+static void
+test_split(cbufq_t *cbufq)
+{
+	cbufq_t *dst;
+	cbuf_t *cbuf;
+	uint16_t u16;
+
+	TEST_CHECK(cbufq_alloc(&dst) == 0);
+	TEST_CHECK(cbufq_count(cbufq) == 1);
+
+	TEST_CHECK(cbufq_split(cbufq, dst, 3) == 0);
+	TEST_CHECK(cbufq_count(dst) == 1);
+	test_get(dst, "abc");
+	test_get(cbufq, "defgh");
+
+	/*
+	 * The moved bytes keep the byte order of the buffer they came from.
+	 */
+	TEST_CHECK((cbuf = cbufq_peek(dst)) != NULL);
+	TEST_CHECK(cbuf_get_u16(cbuf, &u16) == 0 && u16 == 0x6261);
+
+	/*
+	 * The source buffer still has room, and is not shared, so an append
+	 * goes into it rather than into a new buffer.
+	 */
+	TEST_CHECK(cbufq_append(cbufq, "ij", 2) == 0);
+	TEST_CHECK(cbufq_count(cbufq) == 1);
+	test_get(cbufq, "defghij");
+
+	cbufq_free(dst);
+}
+
+static void
+test_split_inline(void)
+{
+	cbufq_t *cbufq;
+	cbuf_t *cbuf;
+
+	TEST_CHECK(cbufq_alloc(&cbufq) == 0);
+	TEST_CHECK(cbuf_alloc(&cbuf, 32) == 0);
+	cbuf_byteorder_set(cbuf, CBUF_ORDER_LITTLE_ENDIAN);
+	for (const char *p = "abcdefgh"; *p != '\0'; p++) {
+		TEST_CHECK(cbuf_put_u8(cbuf, (uint8_t)*p) == 0);
+	}
+	cbuf_flip(cbuf);
+	cbufq_enq(cbufq, cbuf);
+
+	test_split(cbufq);
+	cbufq_free(cbufq);
+}
+
+static void
+test_split_pool(void)
+{
+	size_t sizes[] = { 1024 };
+	cbuf_pool_t *pool;
+	cbufq_t *cbufq;
+	cbuf_t *cbuf;
+
+	TEST_CHECK(cbuf_pool_create(&pool, sizes, 1) == 0);
+	TEST_CHECK(cbufq_alloc(&cbufq) == 0);
+	TEST_CHECK(cbufq_allocator_set(cbufq, pool, 1024) == 0);
+
+	TEST_CHECK(cbufq_append(cbufq, "abcdefgh", 8) == 0);
+	TEST_CHECK((cbuf = cbufq_peek(cbufq)) != NULL);
+	cbuf_byteorder_set(cbuf, CBUF_ORDER_LITTLE_ENDIAN);
+
+	test_split(cbufq);
+	cbufq_free(cbufq);
+	cbuf_pool_destroy(pool);
+}
+
+int
+main(void)
+{
+	test_split_inline();
+	test_split_pool();
+
+	printf("ok\n");
+	return (0);
+}
@@ -0,0 +1,162 @@
+/*
+ * Stress a single-producer, single-consumer queue with a small capacity, so
+ * that it is often full and often empty.  Every buffer must arrive exactly
+ * once and in order, and a consumer that sleeps on the eventfd whenever the
+ * queue is empty must always be woken.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/socket.h>
+
+#include "libcbuf.h"
+
+#define	TEST_CHECK(cond)						\
+	do {								\
+		if (!(cond)) {						\
+			fprintf(stderr, "%s:%d: check failed: %s\n",	\
+			    __FILE__, __LINE__, #cond);			\
+			exit(1);					\
+		}							\
+	} while (0)
+
+#define	TEST_BUFS		200000
+#define	TEST_CAPACITY		8
+#define	TEST_BATCH		5
+#define	TEST_WAIT_MS		10000	/* longer means a lost wakeup */
+
+static cbuf_t *
+test_buf(uint32_t seq)
+{
+	cbuf_t *cbuf;
+
+	TEST_CHECK(cbuf_alloc(&cbuf, sizeof (seq)) == 0);
+	TEST_CHECK(cbuf_put_u32(cbuf, seq) == 0);
+	cbuf_flip(cbuf);
+	return (cbuf);
+}
+
+static void *
+test_producer(void *arg)
+{
+	cbufq_spsc_t *spsc = arg;
+	uint32_t seq = 0;
+
+	while (seq < TEST_BUFS) {
+		uint32_t last = seq;
+
+		if (seq % 3 == 0) {
+			/*
+			 * Enqueue a batch, some of which may not fit.
+			 */
+			cbuf_t *cbufs[TEST_BATCH];
+			size_t n = 0, done;
+
+			while (n < TEST_BATCH && seq + n < TEST_BUFS) {
+				cbufs[n] = test_buf(seq + (uint32_t)n);
+				n++;
+			}
+			done = cbufq_spsc_enq_batch(spsc, cbufs, n);
+			for (size_t i = done; i < n; i++) {
+				cbuf_free(cbufs[i]);
+			}
+			seq += (uint32_t)done;
+		} else {
+			cbuf_t *cbuf = test_buf(seq);
+
+			if (cbufq_spsc_enq(spsc, cbuf) != 0) {
+				TEST_CHECK(errno == ENOSPC);
+				cbuf_free(cbuf);
+			} else {
+				seq++;
+			}
+		}
+
+		if (seq == last) {
+			/*
+			 * The queue is full.
+			 */
+			(void) sched_yield();
+		}
+	}
+
+	return (NULL);
+}
+
+static void
+test_check(cbuf_t *cbuf, uint32_t *next)
+{
+	uint32_t seq;
+
+	TEST_CHECK(cbuf_get_u32(cbuf, &seq) == 0);
+	TEST_CHECK(seq == *next);
+	(*next)++;
+	cbuf_free(cbuf);
+}
+
+int
+main(void)
+{
+	cbufq_spsc_t *spsc;
+	pthread_t producer;
+	uint32_t next = 0;
+	uint64_t sleeps = 0;
+
+	TEST_CHECK(cbufq_spsc_alloc(&spsc, TEST_CAPACITY,
+	    CBUFQ_SPSC_EVENTFD) == 0);
+	TEST_CHECK(cbufq_spsc_fd(spsc) >= 0);
+	TEST_CHECK(pthread_create(&producer, NULL, test_producer, spsc) == 0);
+
+	while (next < TEST_BUFS) {
+		cbuf_t *cbufs[TEST_BATCH];
+		cbuf_t *cbuf;
+		size_t n;
+
+		cbufq_spsc_fd_clear(spsc);
+
+		/*
+		 * Dequeue until the queue is empty, alternating between
+		 * single buffers and batches.
+		 */
+		for (;;) {
+			if ((cbuf = cbufq_spsc_deq(spsc)) == NULL) {
+				break;
+			}
+			test_check(cbuf, &next);
+
+			if ((n = cbufq_spsc_deq_batch(spsc, cbufs,
+			    TEST_BATCH)) == 0) {
+				break;
+			}
+			for (size_t i = 0; i < n; i++) {
+				test_check(cbufs[i], &next);
+			}
+		}
+
+		if (next == TEST_BUFS) {
+			break;
+		}
+
+		struct pollfd pfd = {
+			.fd = cbufq_spsc_fd(spsc),
+			.events = POLLIN,
+		};
+		TEST_CHECK(poll(&pfd, 1, TEST_WAIT_MS) == 1);
+		sleeps++;
+	}
+
+	TEST_CHECK(pthread_join(producer, NULL) == 0);
+	TEST_CHECK(cbufq_spsc_deq(spsc) == NULL);
+	TEST_CHECK(cbufq_spsc_count(spsc) == 0);
+	cbufq_spsc_free(spsc);
+
+	printf("ok (%u buffers, %llu sleeps)\n", (unsigned int)TEST_BUFS,
+	    (unsigned long long)sleeps);
+	return (0);
+}